@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+static void* malloc_allocate(void* user_data, size_t size) {
+    return malloc(size);
+}
+
+static void* malloc_reallocate(void* user_data, void* pointer,
+                               size_t old_size, size_t new_size) {
+    return realloc(pointer, new_size);
+}
+
+static void malloc_release(void* user_data, void* pointer, size_t size) {
+    free(pointer);
+}
+
+template_allocator* default_allocator() {
+    // NOTE(erick): Never written to, so it is safe to share between
+    // contexts and threads.
+    static template_allocator malloc_allocator = {
+        malloc_allocate, malloc_reallocate, malloc_release, NULL
+    };
+    return &malloc_allocator;
+}
+
+void* allocate_memory(template_allocator* allocator, size_t size) {
+    return allocator->allocate(allocator->user_data, size);
+}
+
+void* allocate_zeroed(template_allocator* allocator, size_t count, size_t size) {
+    if(size && count > (size_t) -1 / size) {
+        return NULL;
+    }
+
+    void* result = allocator->allocate(allocator->user_data, count * size);
+    if(result) {
+        memset(result, 0, count * size);
+    }
+    return result;
+}
+
+void* reallocate_memory(template_allocator* allocator, void* pointer,
+                        size_t old_size, size_t new_size) {
+    return allocator->reallocate(allocator->user_data, pointer, old_size, new_size);
+}
+
+void release_memory(template_allocator* allocator, void* pointer, size_t size) {
+    if(pointer) {
+        allocator->release(allocator->user_data, pointer, size);
+    }
+}
+
+char* allocate_string(template_allocator* allocator, size_t length) {
+    return (char*) allocate_memory(allocator, length + 1);
+}
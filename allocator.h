@@ -0,0 +1,27 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H 1
+
+#include <stddef.h>
+
+// NOTE(erick): The library is built with -fvisibility=hidden, only what is
+// marked with TEMPLATE_API is exported by libtemplate.a and libtemplate.so.
+#define TEMPLATE_API __attribute__((visibility("default")))
+
+// NOTE(erick): Every allocation made for a template context goes through
+// one of these. The sizes are passed back on reallocate and release so
+// allocators that don't track them (arenas, pools) can be plugged in.
+typedef struct {
+    void* (*allocate)(void*, size_t);
+    void* (*reallocate)(void*, void*, size_t, size_t);
+    void (*release)(void*, void*, size_t);
+    void* user_data;
+} template_allocator;
+
+template_allocator* default_allocator();
+void* allocate_memory(template_allocator*, size_t);
+void* allocate_zeroed(template_allocator*, size_t, size_t);
+void* reallocate_memory(template_allocator*, void*, size_t, size_t);
+void release_memory(template_allocator*, void*, size_t);
+char* allocate_string(template_allocator*, size_t);
+
+#endif
@@ -0,0 +1,141 @@
+/* Run-scoped allocations.
+ *
+ * The command line tool allocates its file records, paths and template
+ * lookup from a single arena, so generating a file costs no heap calls
+ * and the whole run is freed at once. Blocks are chained and each new one
+ * is at least twice as big as the previous, so even large manifests only
+ * need a handful of them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+static size_t align_up(size_t value) {
+    return (value + (ARENA_ALIGNMENT - 1)) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+static uint8* block_data(arena_block* block) {
+    return (uint8*) block + align_up(sizeof(arena_block));
+}
+
+static bool push_block(arena* arena, size_t size) {
+    size_t block_size = arena->block_size;
+    if(arena->current && block_size < 2 * arena->current->size) {
+        block_size = 2 * arena->current->size;
+    }
+    if(block_size < size) {
+        block_size = size;
+    }
+
+    arena_block* block = (arena_block*) malloc(align_up(sizeof(arena_block)) + block_size);
+    if(!block) {
+        return FALSE;
+    }
+
+    block->previous = arena->current;
+    block->size = block_size;
+    block->used = 0;
+    arena->current = block;
+
+    arena->stats.blocks_count++;
+    arena->stats.bytes_reserved += block_size;
+    return TRUE;
+}
+
+// NOTE(erick): Only the allocation that ends where the current block is
+// used up can be released or grown, which covers LIFO uses like a
+// scratch table freed before anything else is allocated.
+static bool is_last_allocation(arena* arena, void* pointer, size_t size) {
+    arena_block* block = arena->current;
+    return block && pointer &&
+        (uint8*) pointer + size == block_data(block) + block->used;
+}
+
+static void* arena_allocate(void* user_data, size_t size) {
+    arena* arena = user_data;
+    arena_block* block = arena->current;
+
+    size_t offset = block ? align_up(block->used) : 0;
+    if(!block || offset + size > block->size) {
+        if(!push_block(arena, size)) {
+            return NULL;
+        }
+        block = arena->current;
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    arena->stats.allocations_count++;
+    arena->stats.bytes_requested += size;
+    return block_data(block) + offset;
+}
+
+static void* arena_reallocate(void* user_data, void* pointer,
+                              size_t old_size, size_t new_size) {
+    arena* arena = user_data;
+    arena->stats.reallocations_count++;
+
+    if(is_last_allocation(arena, pointer, old_size)) {
+        arena_block* block = arena->current;
+        size_t offset = (uint8*) pointer - block_data(block);
+        if(offset + new_size <= block->size) {
+            block->used = offset + new_size;
+            arena->stats.in_place_count++;
+            if(new_size > old_size) {
+                arena->stats.bytes_requested += new_size - old_size;
+            }
+            return pointer;
+        }
+    }
+
+    void* result = arena_allocate(arena, new_size);
+    if(result && pointer) {
+        memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+    }
+    return result;
+}
+
+static void arena_release(void* user_data, void* pointer, size_t size) {
+    arena* arena = user_data;
+    if(is_last_allocation(arena, pointer, size)) {
+        arena->current->used = (uint8*) pointer - block_data(arena->current);
+        arena->stats.bytes_reclaimed += size;
+    }
+}
+
+void template_arena_init(arena* arena, size_t block_size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+template_allocator template_arena_allocator(arena* arena) {
+    template_allocator result = {
+        arena_allocate, arena_reallocate, arena_release, arena
+    };
+    return result;
+}
+
+void template_arena_free(arena* arena) {
+    while(arena->current) {
+        arena_block* previous = arena->current->previous;
+        free(arena->current);
+        arena->current = previous;
+    }
+}
+
+void template_arena_print_stats(arena* arena, FILE* output) {
+    arena_stats* stats = &arena->stats;
+    fprintf(output,
+            "arena: %llu allocations, %llu reallocations (%llu in place)\n"
+            "arena: %llu bytes requested, %llu reclaimed,"
+            " %llu reserved in %u blocks\n",
+            (unsigned long long) stats->allocations_count,
+            (unsigned long long) stats->reallocations_count,
+            (unsigned long long) stats->in_place_count,
+            (unsigned long long) stats->bytes_requested,
+            (unsigned long long) stats->bytes_reclaimed,
+            (unsigned long long) stats->bytes_reserved,
+            stats->blocks_count);
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H 1
+
+#include <stdio.h>
+#include <stddef.h>
+#include "default_definitions.h"
+#include "allocator.h"
+
+#define ARENA_DEFAULT_BLOCK_SIZE KILO(256)
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block {
+    struct arena_block* previous;
+    size_t size;
+    size_t used;
+} arena_block;
+
+typedef struct {
+    uint64 allocations_count;
+    uint64 reallocations_count;
+    uint64 in_place_count;
+    uint64 bytes_requested;
+    uint64 bytes_reserved;
+    uint64 bytes_reclaimed;
+    uint blocks_count;
+} arena_stats;
+
+// NOTE(erick): A bump allocator. Memory is only given back when the arena
+// is freed, except for the most recent allocations, which can be released
+// (or grown) in place. Not thread safe.
+typedef struct {
+    arena_block* current;
+    size_t block_size;
+    arena_stats stats;
+} arena;
+
+TEMPLATE_API void template_arena_init(arena*, size_t);
+TEMPLATE_API template_allocator template_arena_allocator(arena*);
+TEMPLATE_API void template_arena_free(arena*);
+TEMPLATE_API void template_arena_print_stats(arena*, FILE*);
+
+#endif
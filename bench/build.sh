@@ -0,0 +1,12 @@
+#! /bin/bash
+
+# NOTE(erick): The benchmarks are built into bench/bin. Run them from
+# there, e.g. bench/bin/string_buffer_bench 100 5 or
+# bench/bin/template_bench -o results.json -b previous_results.json
+
+LIB_SOURCES="../libtemplate.c ../allocator.c ../arena.c ../string_buffer.c ../copy_engine.c ../stub_replacer.c ../compiled_template.c ../template_index.c ../extension_table.c ../suffix_trie.c ../stats.c ../output_file.c ../scaffold.c ../worker_pool.c ../template_pack.c ../placeholders.c ../dedupe.c ../decompress.c ../durability.c"
+CFLAGS="-DLINUX=1 -O3 -Wall -I.."
+
+cd "$(dirname "$0")" && mkdir -p bin && \
+gcc $CFLAGS string_buffer_bench.c ../string_buffer.c -o bin/string_buffer_bench && \
+gcc $CFLAGS template_bench.c $LIB_SOURCES -o bin/template_bench -pthread -lz $EXTRA_LIBS
@@ -0,0 +1,170 @@
+/* Micro-benchmark of string_buffer_read_line.
+ *
+ * Usage: string_buffer_bench [MEGABYTES [ITERATIONS]]
+ *
+ * Writes a file with a single line of MEGABYTES (100 by default) and
+ * another one of the same size made of short lines, then reads both with
+ * string_buffer_read_line and, as a baseline, with getline. Prints one
+ * line per case: name, bytes, iterations and the min/median/max time in
+ * milliseconds with the throughput of the median.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "string_buffer.h"
+
+#define SHORT_LINE_LENGTH 80
+#define MAX_ITERATIONS 1000
+
+typedef size_t (*read_function)(FILE*);
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+static void write_test_file(char* path, size_t size, size_t line_length) {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Could not create \"%s\"\n", path);
+        exit(-1);
+    }
+
+    char chunk[KILO(64)];
+    for(size_t i = 0; i < sizeof(chunk); i++) {
+        chunk[i] = 'a' + (i % 26);
+    }
+
+    size_t written = 0;
+    size_t line_written = 0;
+    while(written < size) {
+        size_t to_write = size - written;
+        if(to_write > sizeof(chunk)) {
+            to_write = sizeof(chunk);
+        }
+        if(line_length && to_write > line_length - line_written) {
+            to_write = line_length - line_written;
+        }
+
+        fwrite(chunk, 1, to_write, file);
+        written += to_write;
+        line_written += to_write;
+
+        if(line_length && line_written == line_length) {
+            fputc('\n', file);
+            line_written = 0;
+        }
+    }
+    fputc('\n', file);
+
+    if(fclose(file)) {
+        fprintf(stderr, "Could not write \"%s\"\n", path);
+        exit(-1);
+    }
+}
+
+static size_t read_with_string_buffer(FILE* file) {
+    StringBuffer string_buffer;
+    string_buffer_init(&string_buffer);
+
+    size_t total = 0;
+    while(string_buffer_read_line(file, &string_buffer)) {
+        total += string_buffer.length;
+    }
+
+    free_string_buffer(&string_buffer);
+    return total;
+}
+
+static size_t read_with_getline(FILE* file) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t line_len;
+
+    size_t total = 0;
+    while((line_len = getline(&line, &capacity, file)) > 0) {
+        total += line_len - (line[line_len - 1] == '\n');
+    }
+
+    free(line);
+    return total;
+}
+
+static void run_case(char* name, char* path, size_t expected_bytes,
+                     read_function read_lines, int iterations) {
+    double times[MAX_ITERATIONS];
+
+    for(int iteration = 0; iteration < iterations; iteration++) {
+        FILE* file = fopen(path, "r");
+        if(!file) {
+            fprintf(stderr, "Could not open \"%s\"\n", path);
+            exit(-1);
+        }
+
+        double start = now_ms();
+        size_t bytes = read_lines(file);
+        times[iteration] = now_ms() - start;
+        fclose(file);
+
+        if(bytes != expected_bytes) {
+            fprintf(stderr, "%s: read %zu bytes, expected %zu\n", name, bytes,
+                    expected_bytes);
+            exit(-1);
+        }
+    }
+
+    qsort(times, iterations, sizeof(double), compare_doubles);
+    double median = times[iterations / 2];
+    printf("%-24s %12zu %4d %10.2f %10.2f %10.2f %10.1f\n", name, expected_bytes,
+           iterations, times[0], median, times[iterations - 1],
+           (expected_bytes / (1024.0 * 1024.0)) / (median / 1000.0));
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 5;
+    if(megabytes == 0 || iterations < 1 || iterations > MAX_ITERATIONS) {
+        fprintf(stderr, "Usage: %s [MEGABYTES [ITERATIONS]]\n", argv[0]);
+        return -1;
+    }
+
+    size_t size = MEGA(megabytes);
+    char* temp_dir = getenv("TMPDIR");
+    if(!temp_dir || !*temp_dir) {
+        temp_dir = "/tmp";
+    }
+
+    char long_line_path[PATH_MAX];
+    char short_lines_path[PATH_MAX];
+    snprintf(long_line_path, PATH_MAX, "%s/string_buffer_bench.%d.long", temp_dir,
+             (int) getpid());
+    snprintf(short_lines_path, PATH_MAX, "%s/string_buffer_bench.%d.short", temp_dir,
+             (int) getpid());
+
+    write_test_file(long_line_path, size, 0);
+    write_test_file(short_lines_path, size, SHORT_LINE_LENGTH);
+
+    printf("%-24s %12s %4s %10s %10s %10s %10s\n", "case", "bytes", "runs",
+           "min_ms", "median_ms", "max_ms", "MB/s");
+    run_case("single_line", long_line_path, size, read_with_string_buffer, iterations);
+    run_case("single_line_getline", long_line_path, size, read_with_getline, iterations);
+    run_case("short_lines", short_lines_path, size, read_with_string_buffer, iterations);
+    run_case("short_lines_getline", short_lines_path, size, read_with_getline, iterations);
+
+    unlink(long_line_path);
+    unlink(short_lines_path);
+    return 0;
+}
@@ -0,0 +1,701 @@
+/* Benchmark of the stages of a run on synthetic template directories.
+ *
+ * Usage: template_bench [-t COUNTS] [-f FILES] [-s SIZES] [-p DENSITIES]
+ *                       [-n ITERATIONS] [-o OUTPUT] [-b BASELINE] [-r PERCENT]
+ *
+ *   -t  Comma separated template counts (10,1000,100000). A directory with
+ *       that many templates is generated for each count and used for the
+ *       dir_resolution, lookup_init and get_template_files stages.
+ *   -f  Files requested per iteration (1000).
+ *   -s  Comma separated template sizes in bytes (1024,65536,1048576).
+ *   -p  Comma separated stub densities in stubs per KiB (0,1,16). Every
+ *       size and density pair gets a template that is used for the
+ *       compile_template, copy_without_replacement and copy_file stages.
+ *       FILES copies of a 4 KiB template are also made and synced with
+ *       each --durability mode, a sample being the whole batch.
+ *   -n  Iterations of each stage (20).
+ *   -o  File for the results (the standard output by default).
+ *   -b  Results of a previous run. Benchmarks whose median got more than
+ *       -r percent (10) slower are reported and the exit status is 1.
+ *
+ * Everything is generated under $TMPDIR (/tmp by default) and removed at
+ * the end. The index cache and user-dirs.dirs are redirected there too.
+ *
+ * Each result is a JSON object on its own line:
+ *   {"name":"...","unit":"ns","samples":N,"min":...,"p50":...,"p90":...,
+ *    "p99":...,"max":...,"mean":...}
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "template.h"
+
+#define MAX_LIST_VALUES 16
+#define MAX_RESULTS 256
+#define MAX_NAME_LENGTH 128
+#define DIR_RESOLUTION_CALLS 100
+#define MISSING_EXTENSIONS_PERCENT 10
+#define DURABILITY_TEMPLATE_SIZE KILO(4)
+
+typedef struct {
+    uint64 values[MAX_LIST_VALUES];
+    int count;
+} value_list;
+
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    double p50;
+} bench_result;
+
+typedef struct {
+    char* root;
+    int files_count;
+    int iterations;
+    FILE* output;
+
+    double* samples;
+    size_t samples_capacity;
+
+    bench_result results[MAX_RESULTS];
+    int results_count;
+} bench_context;
+
+static uint64 random_state = 0x9E3779B97F4A7C15ULL;
+
+// NOTE(erick): xorshift64. The workloads are the same on every run.
+static uint64 next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+static void parse_list(char* argument, value_list* list) {
+    list->count = 0;
+    char* cursor = argument;
+    while(*cursor && list->count < MAX_LIST_VALUES) {
+        list->values[list->count++] = strtoull(cursor, &cursor, 10);
+        if(*cursor == ',') {
+            cursor++;
+        } else if(*cursor) {
+            exit_on_error("Invalid list: \"%s\"\n", argument);
+        }
+    }
+}
+
+static double* reserve_samples(bench_context* context, size_t count) {
+    if(count > context->samples_capacity) {
+        free(context->samples);
+        context->samples = (double*) malloc(count * sizeof(double));
+        if(!context->samples) {
+            exit_on_error("Could not allocate memory\n");
+        }
+        context->samples_capacity = count;
+    }
+    return context->samples;
+}
+
+static double percentile(double* sorted_samples, size_t count, double fraction) {
+    size_t index = (size_t) (fraction * (count - 1) + 0.5);
+    return sorted_samples[index];
+}
+
+static void report(bench_context* context, char* name, double* samples, size_t count) {
+    if(count == 0) {
+        return;
+    }
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    double sum = 0;
+    for(size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    double p50 = percentile(samples, count, 0.50);
+    fprintf(context->output,
+            "{\"name\":\"%s\",\"unit\":\"ns\",\"samples\":%zu,\"min\":%.0f,"
+            "\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f,\"max\":%.0f,\"mean\":%.0f}\n",
+            name, count, samples[0], p50, percentile(samples, count, 0.90),
+            percentile(samples, count, 0.99), samples[count - 1], sum / count);
+    fflush(context->output);
+
+    fprintf(stderr, "%-56s p50 %12.0f ns  p99 %12.0f ns\n", name, p50,
+            percentile(samples, count, 0.99));
+
+    if(context->results_count < MAX_RESULTS) {
+        bench_result* result = context->results + context->results_count++;
+        snprintf(result->name, MAX_NAME_LENGTH, "%s", name);
+        result->p50 = p50;
+    }
+}
+
+static void write_file(char* path, char* data, size_t size) {
+    FILE* file = fopen(path, "wb");
+    if(!file || fwrite(data, 1, size, file) != size || fclose(file)) {
+        exit_on_error("Could not write \"%s\"\n", path);
+    }
+}
+
+static int remove_entry(const char* path, const struct stat* stat_buffer,
+                        int type, struct FTW* ftw_buffer) {
+    return remove(path);
+}
+
+static void remove_tree(char* path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static void join_path(char* dest, char* dir, char* name) {
+    if(snprintf(dest, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX) {
+        exit_on_error("The path is too long: \"%s/%s\"\n", dir, name);
+    }
+}
+
+static void make_dir(char* path) {
+    if(mkdir(path, 0755) && access(path, F_OK)) {
+        exit_on_error("Could not create \"%s\"\n", path);
+    }
+}
+
+// NOTE(erick): The index isn't cached for directories modified in the
+// current second, so the generated ones are moved to the past.
+static void age_dir(char* path) {
+    struct timespec times[2];
+    clock_gettime(CLOCK_REALTIME, times);
+    times[0].tv_sec -= 10;
+    times[1] = times[0];
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+// NOTE(erick): Half of the templates have a multi-component extension so
+// the suffix trie does some real work.
+static void template_name(char* buffer, size_t buffer_size, uint index) {
+    if(index % 2) {
+        snprintf(buffer, buffer_size, "tpl%u.sub%u.e%u", index, index, index);
+    } else {
+        snprintf(buffer, buffer_size, "tpl%u.e%u", index, index);
+    }
+}
+
+static void generate_lookup_dir(char* dir, uint templates_count) {
+    make_dir(dir);
+
+    char path[PATH_MAX];
+    char name[MAX_NAME_LENGTH];
+    char content[] = "// ??? generated\n";
+    for(uint i = 0; i < templates_count; i++) {
+        template_name(name, sizeof(name), i);
+        join_path(path, dir, name);
+        write_file(path, content, sizeof(content) - 1);
+    }
+    age_dir(dir);
+}
+
+static void generate_template(char* path, size_t size, uint stubs_per_kilo) {
+    char* data = (char*) malloc(size + 1);
+    if(!data) {
+        exit_on_error("Could not allocate memory\n");
+    }
+
+    for(size_t i = 0; i < size; i++) {
+        data[i] = (i % 64 == 63) ? '\n' : 'a' + (next_random() % 26);
+    }
+
+    if(stubs_per_kilo) {
+        size_t stub_distance = KILO(1) / stubs_per_kilo;
+        if(stub_distance < strlen(STUB_STR)) {
+            stub_distance = strlen(STUB_STR);
+        }
+        for(size_t i = 0; i + strlen(STUB_STR) <= size; i += stub_distance) {
+            memcpy(data + i, STUB_STR, strlen(STUB_STR));
+        }
+    }
+
+    write_file(path, data, size);
+    free(data);
+}
+
+static void set_bench_environment(bench_context* context, char* template_dir) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/config/user-dirs.dirs", context->root);
+
+    char line[PATH_MAX + 64];
+    int line_len = snprintf(line, sizeof(line), "XDG_TEMPLATES_DIR=\"%s\"\n", template_dir);
+    write_file(path, line, line_len);
+}
+
+static void bench_dir_resolution(bench_context* context, char* template_dir,
+                                 uint templates_count) {
+    set_bench_environment(context, template_dir);
+
+    size_t count = (size_t) context->iterations * DIR_RESOLUTION_CALLS;
+    double* samples = reserve_samples(context, count);
+    char template_dir_name[MAX_DIR_NAME];
+
+    for(size_t i = 0; i < count; i++) {
+        double start = now_ns();
+        bool found = get_template_dir(template_dir_name, NULL);
+        samples[i] = now_ns() - start;
+
+        if(!found || strcmp(template_dir_name, template_dir) != 0) {
+            exit_on_error("get_template_dir found \"%s\"\n", template_dir_name);
+        }
+    }
+
+    char name[MAX_NAME_LENGTH];
+    snprintf(name, MAX_NAME_LENGTH, "dir_resolution/templates=%u", templates_count);
+    report(context, name, samples, count);
+}
+
+static void bench_lookup_init(bench_context* context, char* template_dir,
+                              uint templates_count, bool rebuild_index) {
+    double* samples = reserve_samples(context, context->iterations);
+    template_lookup lookup;
+
+    for(int i = 0; i < context->iterations; i++) {
+        double start = now_ns();
+        template_error error = init_template_lookup(&lookup, template_dir, rebuild_index,
+                                                    default_allocator());
+        samples[i] = now_ns() - start;
+
+        if(error != TEMPLATE_OK) {
+            exit_on_error("init_template_lookup: %s\n", template_error_string(error));
+        }
+        free_template_lookup(&lookup);
+    }
+
+    char name[MAX_NAME_LENGTH];
+    snprintf(name, MAX_NAME_LENGTH, "lookup_init_%s/templates=%u",
+             rebuild_index ? "rebuild" : "cached", templates_count);
+    report(context, name, samples, context->iterations);
+}
+
+static void bench_get_template_files(bench_context* context, char* template_dir,
+                                     uint templates_count) {
+    template_lookup lookup;
+    if(init_template_lookup(&lookup, template_dir, FALSE,
+                            default_allocator()) != TEMPLATE_OK) {
+        exit_on_error("Could not load \"%s\"\n", template_dir);
+    }
+
+    int files_count = context->files_count;
+    file_data* requested = (file_data*) calloc(files_count, sizeof(file_data));
+    file_data* files = (file_data*) calloc(files_count, sizeof(file_data));
+    char* paths = (char*) malloc(files_count * (size_t) PATH_MAX);
+    if(!requested || !files || !paths) {
+        exit_on_error("Could not allocate memory\n");
+    }
+
+    // NOTE(erick): Some of the files ask for extensions nobody provides.
+    uint extensions_count = templates_count +
+        (templates_count * MISSING_EXTENSIONS_PERCENT) / 100 + 1;
+    for(int i = 0; i < files_count; i++) {
+        char* path = paths + (size_t) i * PATH_MAX;
+        uint extension = next_random() % extensions_count;
+        if(extension % 2) {
+            snprintf(path, PATH_MAX, "%s/out%d.sub%u.e%u", context->root, i,
+                     extension, extension);
+        } else {
+            snprintf(path, PATH_MAX, "%s/out%d.e%u", context->root, i, extension);
+        }
+        requested[i].file_path = path;
+    }
+    get_files_names(requested, files_count);
+    get_files_extensions(requested, files_count);
+
+    double* samples = reserve_samples(context, context->iterations);
+    for(int i = 0; i < context->iterations; i++) {
+        memcpy(files, requested, files_count * sizeof(file_data));
+
+        double start = now_ns();
+        get_template_files(files, files_count, &lookup);
+        samples[i] = now_ns() - start;
+    }
+
+    char name[MAX_NAME_LENGTH];
+    snprintf(name, MAX_NAME_LENGTH, "get_template_files/templates=%u,files=%d",
+             templates_count, files_count);
+    report(context, name, samples, context->iterations);
+
+    free(requested);
+    free(files);
+    free(paths);
+    free_template_lookup(&lookup);
+}
+
+static void bench_lookup_stages(bench_context* context, uint templates_count) {
+    char template_dir[PATH_MAX];
+    snprintf(template_dir, PATH_MAX, "%s/lookup-%u", context->root, templates_count);
+    generate_lookup_dir(template_dir, templates_count);
+
+    bench_dir_resolution(context, template_dir, templates_count);
+    bench_lookup_init(context, template_dir, templates_count, TRUE);
+    bench_lookup_init(context, template_dir, templates_count, FALSE);
+    bench_get_template_files(context, template_dir, templates_count);
+
+    remove_tree(template_dir);
+}
+
+static void remove_outputs(file_data* files, int files_count) {
+    for(int i = 0; i < files_count; i++) {
+        unlink(files[i].file_path);
+    }
+}
+
+static void bench_copy_stages(bench_context* context, size_t template_size,
+                              uint stubs_per_kilo) {
+    char template_dir[PATH_MAX];
+    char output_dir[PATH_MAX];
+    char template_path[PATH_MAX];
+    snprintf(template_dir, PATH_MAX, "%s/copy-%zu-%u", context->root, template_size,
+             stubs_per_kilo);
+    join_path(output_dir, template_dir, "output");
+    join_path(template_path, template_dir, "bench.bt");
+
+    make_dir(template_dir);
+    make_dir(output_dir);
+    generate_template(template_path, template_size, stubs_per_kilo);
+    age_dir(template_dir);
+
+    char name[MAX_NAME_LENGTH];
+    char params[MAX_NAME_LENGTH / 2];
+    snprintf(params, sizeof(params), "size=%zu,stubs_per_kib=%u", template_size,
+             stubs_per_kilo);
+
+    double* samples = reserve_samples(context, context->iterations);
+    compiled_template compiled;
+    for(int i = 0; i < context->iterations; i++) {
+        double start = now_ns();
+        bool compiled_ok = compile_template(template_path, -1, STUB_STR, COMPRESSION_NONE,
+                                            &compiled, default_allocator());
+        samples[i] = now_ns() - start;
+
+        if(!compiled_ok) {
+            exit_on_error("Could not compile \"%s\"\n", template_path);
+        }
+        free_compiled_template(&compiled);
+    }
+    snprintf(name, MAX_NAME_LENGTH, "compile_template/%s", params);
+    report(context, name, samples, context->iterations);
+
+    int files_count = context->files_count;
+    file_data* files = (file_data*) calloc(files_count, sizeof(file_data));
+    char* paths = (char*) malloc(files_count * (size_t) PATH_MAX);
+    if(!files || !paths) {
+        exit_on_error("Could not allocate memory\n");
+    }
+
+    for(int i = 0; i < files_count; i++) {
+        char output_name[MAX_NAME_LENGTH];
+        snprintf(output_name, MAX_NAME_LENGTH, "out%d.bt", i);
+        files[i].file_path = paths + (size_t) i * PATH_MAX;
+        join_path(files[i].file_path, output_dir, output_name);
+        files[i].template_file_path = template_path;
+        files[i].template_fd = -1;
+        files[i].output_fd = -1;
+    }
+    get_files_names(files, files_count);
+
+    size_t count = (size_t) files_count * context->iterations;
+    samples = reserve_samples(context, count);
+
+    // NOTE(erick): Samples are single files. The outputs are removed
+    // between iterations, outside of the measurement.
+    for(int iteration = 0; iteration < context->iterations; iteration++) {
+        for(int i = 0; i < files_count; i++) {
+            file_data* file = files + i;
+            file->error = TEMPLATE_OK;
+            file->failed = FALSE;
+
+            double start = now_ns();
+            copy_strategy strategy = copy_without_replacement(file);
+            samples[(size_t) iteration * files_count + i] = now_ns() - start;
+
+            if(strategy == COPY_STRATEGY_FAILED) {
+                exit_on_error("copy_without_replacement failed for \"%s\"\n",
+                              file->file_path);
+            }
+        }
+        remove_outputs(files, files_count);
+    }
+    snprintf(name, MAX_NAME_LENGTH, "copy_without_replacement/%s", params);
+    report(context, name, samples, count);
+
+    // NOTE(erick): Replacement mode the way the tool runs it: the template
+    // is compiled once and every file is a copy_file.
+    template_lookup lookup;
+    if(init_template_lookup(&lookup, template_dir, FALSE,
+                            default_allocator()) != TEMPLATE_OK) {
+        exit_on_error("Could not load \"%s\"\n", template_dir);
+    }
+
+    for(int i = 0; i < files_count; i++) {
+        files[i].replace = REPLACE_WITH_NAME;
+        files[i].file_extension = "bt";
+        files[i].template_file_path = NULL;
+        files[i].compiled_template = NULL;
+        files[i].error = TEMPLATE_OK;
+        files[i].failed = FALSE;
+    }
+    get_template_files(files, files_count, &lookup);
+    compile_templates(files, files_count, &lookup, FALSE);
+
+    for(int iteration = 0; iteration < context->iterations; iteration++) {
+        for(int i = 0; i < files_count; i++) {
+            file_data* file = files + i;
+
+            double start = now_ns();
+            bool copied = copy_file(file);
+            samples[(size_t) iteration * files_count + i] = now_ns() - start;
+
+            if(!copied || file->error != TEMPLATE_OK) {
+                exit_on_error("copy_file failed for \"%s\": %s\n", file->file_path,
+                              template_error_string(file->error));
+            }
+        }
+        remove_outputs(files, files_count);
+    }
+    snprintf(name, MAX_NAME_LENGTH, "copy_file_replace/%s", params);
+    report(context, name, samples, count);
+
+    free_template_lookup(&lookup);
+    free(files);
+    free(paths);
+    remove_tree(template_dir);
+}
+
+// NOTE(erick): The cost of each durability mode is mostly waiting for the
+// disk, so the samples are whole batches: the copies and their syncs.
+static void bench_durability(bench_context* context) {
+    char template_dir[PATH_MAX];
+    char output_dir[PATH_MAX];
+    char template_path[PATH_MAX];
+    snprintf(template_dir, PATH_MAX, "%s/durability", context->root);
+    join_path(output_dir, template_dir, "output");
+    join_path(template_path, template_dir, "bench.bt");
+
+    make_dir(template_dir);
+    make_dir(output_dir);
+    generate_template(template_path, DURABILITY_TEMPLATE_SIZE, 0);
+
+    int files_count = context->files_count;
+    file_data* files = (file_data*) calloc(files_count, sizeof(file_data));
+    char* paths = (char*) malloc(files_count * (size_t) PATH_MAX);
+    if(!files || !paths) {
+        exit_on_error("Could not allocate memory\n");
+    }
+
+    for(int i = 0; i < files_count; i++) {
+        char output_name[MAX_NAME_LENGTH];
+        snprintf(output_name, MAX_NAME_LENGTH, "out%d.bt", i);
+        files[i].file_path = paths + (size_t) i * PATH_MAX;
+        join_path(files[i].file_path, output_dir, output_name);
+        files[i].template_file_path = template_path;
+        files[i].template_fd = -1;
+        files[i].output_fd = -1;
+    }
+    get_files_names(files, files_count);
+
+    durability_mode modes[] = {DURABILITY_NONE, DURABILITY_BATCH, DURABILITY_FILE};
+    char* mode_names[] = {"none", "batch", "file"};
+    double* samples = reserve_samples(context, context->iterations);
+
+    for(int mode_index = 0; mode_index < 3; mode_index++) {
+        for(int iteration = 0; iteration < context->iterations; iteration++) {
+            double start = now_ns();
+            for(int i = 0; i < files_count; i++) {
+                file_data* file = files + i;
+                file->error = TEMPLATE_OK;
+                file->failed = FALSE;
+                file->durability = modes[mode_index];
+                copy_file(file);
+            }
+            make_outputs_durable(files, files_count, modes[mode_index], 1);
+            samples[iteration] = now_ns() - start;
+
+            for(int i = 0; i < files_count; i++) {
+                if(files[i].error != TEMPLATE_OK) {
+                    exit_on_error("Could not generate \"%s\": %s\n", files[i].file_path,
+                                  template_error_string(files[i].error));
+                }
+            }
+            remove_outputs(files, files_count);
+        }
+
+        char name[MAX_NAME_LENGTH];
+        snprintf(name, MAX_NAME_LENGTH, "durability/mode=%s,files=%d",
+                 mode_names[mode_index], files_count);
+        report(context, name, samples, context->iterations);
+    }
+
+    free(files);
+    free(paths);
+    remove_tree(template_dir);
+}
+
+// NOTE(erick): Reads back the name and p50 of our own output format.
+static int compare_with_baseline(bench_context* context, char* baseline_path,
+                                 double threshold_percent) {
+    FILE* baseline = fopen(baseline_path, "r");
+    if(!baseline) {
+        exit_on_error("Could not open the baseline: \"%s\"\n", baseline_path);
+    }
+
+    int regressions_count = 0;
+    char line[KILO(1)];
+    while(fgets(line, sizeof(line), baseline)) {
+        char* name_start = strstr(line, "\"name\":\"");
+        char* p50_start = strstr(line, "\"p50\":");
+        if(!name_start || !p50_start) {
+            continue;
+        }
+
+        name_start += strlen("\"name\":\"");
+        char* name_end = strchr(name_start, '"');
+        if(!name_end || name_end - name_start >= MAX_NAME_LENGTH) {
+            continue;
+        }
+        *name_end = '\0';
+        double baseline_p50 = strtod(p50_start + strlen("\"p50\":"), NULL);
+
+        for(int i = 0; i < context->results_count; i++) {
+            bench_result* result = context->results + i;
+            if(strcmp(result->name, name_start) != 0 || baseline_p50 <= 0) {
+                continue;
+            }
+
+            double change = 100.0 * (result->p50 - baseline_p50) / baseline_p50;
+            if(change > threshold_percent) {
+                fprintf(stderr, "REGRESSION %s: p50 %.0f ns -> %.0f ns (%+.1f%%)\n",
+                        result->name, baseline_p50, result->p50, change);
+                regressions_count++;
+            }
+        }
+    }
+
+    fclose(baseline);
+    return regressions_count;
+}
+
+void exit_on_error(char* msg, ...) {
+    va_list args;
+    va_start(args, msg);
+
+    vfprintf(stderr, msg, args);
+
+    va_end(args);
+    exit(-1);
+}
+
+int main(int argc, char** argv) {
+    bench_context context;
+    memset(&context, 0, sizeof(context));
+    context.files_count = 1000;
+    context.iterations = 20;
+    context.output = stdout;
+
+    value_list templates_counts;
+    value_list template_sizes;
+    value_list stub_densities;
+    parse_list("10,1000,100000", &templates_counts);
+    parse_list("1024,65536,1048576", &template_sizes);
+    parse_list("0,1,16", &stub_densities);
+
+    char* baseline_path = NULL;
+    double threshold_percent = 10;
+
+    int option;
+    while((option = getopt(argc, argv, "t:f:s:p:n:o:b:r:")) != -1) {
+        switch(option) {
+        case 't' : parse_list(optarg, &templates_counts); break;
+        case 's' : parse_list(optarg, &template_sizes); break;
+        case 'p' : parse_list(optarg, &stub_densities); break;
+        case 'f' : context.files_count = atoi(optarg); break;
+        case 'n' : context.iterations = atoi(optarg); break;
+        case 'b' : baseline_path = optarg; break;
+        case 'r' : threshold_percent = atof(optarg); break;
+        case 'o' :
+            context.output = fopen(optarg, "w");
+            if(!context.output) {
+                exit_on_error("Could not open \"%s\"\n", optarg);
+            }
+            break;
+        default :
+            exit_on_error("Usage: %s [-t COUNTS] [-f FILES] [-s SIZES] [-p DENSITIES]"
+                          " [-n ITERATIONS] [-o OUTPUT] [-b BASELINE] [-r PERCENT]\n",
+                          argv[0]);
+        }
+    }
+
+    if(context.files_count < 1 || context.iterations < 1) {
+        exit_on_error("FILES and ITERATIONS must be positive\n");
+    }
+
+    char* temp_dir = getenv("TMPDIR");
+    if(!temp_dir || !*temp_dir) {
+        temp_dir = "/tmp";
+    }
+    if(asprintf(&context.root, "%s/template-bench-%d", temp_dir, (int) getpid()) < 0) {
+        exit_on_error("Could not allocate memory\n");
+    }
+    make_dir(context.root);
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/config", context.root);
+    make_dir(path);
+    setenv("XDG_CONFIG_HOME", path, 1);
+    snprintf(path, PATH_MAX, "%s/cache", context.root);
+    make_dir(path);
+    setenv("XDG_CACHE_HOME", path, 1);
+    unsetenv(TEMPLATE_DIR_VAR);
+
+    for(int i = 0; i < templates_counts.count; i++) {
+        bench_lookup_stages(&context, (uint) templates_counts.values[i]);
+    }
+
+    for(int i = 0; i < template_sizes.count; i++) {
+        for(int j = 0; j < stub_densities.count; j++) {
+            bench_copy_stages(&context, template_sizes.values[i],
+                              (uint) stub_densities.values[j]);
+        }
+    }
+
+    bench_durability(&context);
+
+    remove_tree(context.root);
+    free(context.root);
+    free(context.samples);
+    if(context.output != stdout) {
+        fclose(context.output);
+    }
+
+    if(baseline_path &&
+       compare_with_baseline(&context, baseline_path, threshold_percent)) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -3,5 +3,23 @@
 # Should be done only if working_dir don't exists
 # ln -s $PWD /tmp/working_dir 2> /dev/null
 
-gcc -DLINUX=1 template.c string_buffer.c -o template -O3 -Wall && cp template ~/.local/bin/template
+# NOTE(erick): libtemplate.a and libtemplate.so hold everything but the
+# command line tool, see libtemplate.h.
+LIB_SOURCES="libtemplate.c allocator.c arena.c string_buffer.c copy_engine.c stub_replacer.c compiled_template.c template_index.c extension_table.c suffix_trie.c stats.c output_file.c scaffold.c worker_pool.c template_pack.c placeholders.c dedupe.c decompress.c durability.c"
+CLI_SOURCES="template.c uring_backend.c template_server.c"
+# NOTE(erick): EXTRA_CFLAGS=-DTEMPLATE_STATS=1 ./build.sh enables --stats.
+# EXTRA_CFLAGS=-DTEMPLATE_ZSTD=1 EXTRA_LIBS=-lzstd ./build.sh adds .zst
+# templates to the .gz ones (see decompress.c).
+CFLAGS="-DLINUX=1 -O3 -Wall $EXTRA_CFLAGS"
+LIBS="-pthread -lz $EXTRA_LIBS"
 
+# NOTE(erick): Only the functions marked with TEMPLATE_API (libtemplate.h
+# and arena.h) are global in the libraries. The objects are linked into a
+# single one for libtemplate.a so the hidden symbols can be made local, the
+# command line tool uses the objects as they are.
+gcc $CFLAGS -fPIC -fvisibility=hidden -c $LIB_SOURCES && \
+ld -r -o libtemplate_all.o ${LIB_SOURCES//.c/.o} && \
+objcopy --localize-hidden libtemplate_all.o && \
+rm -f libtemplate.a && ar rcs libtemplate.a libtemplate_all.o && \
+gcc -shared -o libtemplate.so ${LIB_SOURCES//.c/.o} $LIBS && \
+gcc $CFLAGS $CLI_SOURCES ${LIB_SOURCES//.c/.o} -o template $LIBS && cp template ~/.local/bin/template
@@ -0,0 +1,361 @@
+/* Templates used by several outputs in replace mode are mapped into memory
+ * and scanned for stubs only once. Each output is then a writev of the
+ * literal spans interleaved with its own values, so the per-output cost is
+ * one open, one writev and one close.
+ *
+ * Compressed templates used by their inner name are decompressed into
+ * memory here (see decompress.c), so they can only be used compiled.
+ *
+ * Only the stubs are recorded. A placeholder ("???KEY???") is two stubs
+ * with a key between them, which is checked when the output is written,
+ * so the same compiled template (or template pack) works whatever keys
+ * were defined.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "compiled_template.h"
+#include "copy_engine.h"
+#include "stub_replacer.h"
+#include "decompress.h"
+#include "stats.h"
+
+static bool push_stub_offset(compiled_template* template, size_t offset) {
+    if(template->stub_count == template->stub_capacity) {
+        uint new_capacity = template->stub_capacity ? template->stub_capacity * 2 : 16;
+        size_t* new_offsets = (size_t*) reallocate_memory(
+            template->allocator, template->stub_offsets,
+            template->stub_capacity * sizeof(size_t), new_capacity * sizeof(size_t));
+        if(!new_offsets) {
+            return FALSE;
+        }
+
+        template->stub_offsets = new_offsets;
+        template->stub_capacity = new_capacity;
+    }
+
+    template->stub_offsets[template->stub_count++] = offset;
+    return TRUE;
+}
+
+// NOTE(erick): template_fd is the template already open (it is closed
+// here) or -1 to open template_file_path. compression is how the file is
+// read, COMPRESSION_NONE maps it as it is whatever its name.
+bool compile_template(char* template_file_path, int template_fd, char* stub,
+                      compression_format compression, compiled_template* template,
+                      template_allocator* allocator) {
+    memset(template, 0, sizeof(compiled_template));
+    template->allocator = allocator;
+    template->template_file_path = template_file_path;
+    template->stub_len = strlen(stub);
+
+    if(template_fd < 0) {
+        STATS_SYSCALL(SYSCALL_OPEN);
+        template_fd = open(template_file_path, O_RDONLY);
+        if(template_fd < 0) {
+            return FALSE;
+        }
+    }
+
+    STATS_SYSCALL(SYSCALL_STAT);
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    struct stat stat_buffer;
+    if(fstat(template_fd, &stat_buffer) || !S_ISREG(stat_buffer.st_mode)) {
+        close(template_fd);
+        return FALSE;
+    }
+
+    template->data_size = stat_buffer.st_size;
+    template->mode = stat_buffer.st_mode;
+
+    // NOTE(erick): mmap refuses empty mappings. An empty template is just
+    // a template without spans.
+    if(compression != COMPRESSION_NONE) {
+        if(!decompress_template(template_fd, compression, stat_buffer.st_size,
+                                &template->data, &template->data_size)) {
+            close(template_fd);
+            return FALSE;
+        }
+    } else if(template->data_size) {
+        STATS_SYSCALL(SYSCALL_MMAP);
+        STATS_BYTES_READ(template->data_size);
+        void* data = mmap(NULL, template->data_size, PROT_READ, MAP_PRIVATE,
+                          template_fd, 0);
+        if(data == MAP_FAILED) {
+            close(template_fd);
+            return FALSE;
+        }
+        template->data = (uint8*) data;
+        madvise(data, template->data_size, MADV_SEQUENTIAL);
+    }
+
+    // NOTE(erick): The mapping stays valid after the descriptor is closed.
+    close(template_fd);
+
+    uint8* data_end = template->data + template->data_size;
+    uint8* cursor = template->data;
+
+    while(template->stub_len && data_end - cursor >= (ssize_t) template->stub_len) {
+        cursor = (uint8*) memchr(cursor, stub[0],
+                                 (data_end - cursor) - template->stub_len + 1);
+        if(!cursor) {
+            break;
+        }
+
+        if(memcmp(cursor, stub, template->stub_len) == 0) {
+            if(!push_stub_offset(template, cursor - template->data)) {
+                free_compiled_template(template);
+                return FALSE;
+            }
+            cursor += template->stub_len;
+        } else {
+            cursor++;
+        }
+    }
+
+    return TRUE;
+}
+
+// NOTE(erick): Where an output is between the spans of its template.
+typedef struct {
+    uint stub_index;
+    size_t span_start;
+} output_cursor;
+
+// NOTE(erick): Fills iovecs with the next pieces of an output: literal
+// spans and the values of the stubs between them. Two stubs with a key
+// between them are a placeholder and take a single value. The output is
+// complete once the cursor is past the last stub.
+static int next_output_pieces(compiled_template* template, placeholder_values* values,
+                              output_cursor* cursor, struct iovec* iovecs, int max_iovecs) {
+    int iovecs_count = 0;
+
+    while(cursor->stub_index <= template->stub_count && iovecs_count + 2 <= max_iovecs) {
+        uint stub_index = cursor->stub_index++;
+        size_t span_end = (stub_index < template->stub_count) ?
+            template->stub_offsets[stub_index] : template->data_size;
+
+        if(span_end > cursor->span_start) {
+            iovecs[iovecs_count].iov_base = template->data + cursor->span_start;
+            iovecs[iovecs_count].iov_len = span_end - cursor->span_start;
+            iovecs_count++;
+        }
+
+        if(stub_index == template->stub_count) {
+            break;
+        }
+
+        char* value = values->stub_value;
+        size_t value_len = values->stub_value_len;
+        cursor->span_start = span_end + template->stub_len;
+
+        if(stub_index + 1 < template->stub_count) {
+            size_t next_stub_end = template->stub_offsets[stub_index + 1] + template->stub_len;
+            size_t placeholder_len;
+            int key = find_placeholder(values->set, template->data + cursor->span_start,
+                                       next_stub_end - cursor->span_start,
+                                       &placeholder_len);
+            if(key != PLACEHOLDER_NO_KEY) {
+                value = values->values[key];
+                value_len = values->value_lens[key];
+                cursor->span_start = next_stub_end;
+                cursor->stub_index++;
+            }
+        }
+
+        if(value_len) {
+            iovecs[iovecs_count].iov_base = value;
+            iovecs[iovecs_count].iov_len = value_len;
+            iovecs_count++;
+        }
+    }
+
+    return iovecs_count;
+}
+
+bool write_compiled_template(compiled_template* template, int output_fd,
+                             placeholder_values* values) {
+    struct iovec iovecs[REPLACE_MAX_IOVECS];
+
+    // NOTE(erick): Without values the template is copied as is.
+    if(!values) {
+        int whole_template = compiled_template_iovecs(template, NULL, iovecs, 1);
+        return write_iovecs(output_fd, iovecs, whole_template);
+    }
+
+    // NOTE(erick): Usually the whole output fits a single writev. Templates
+    // with lots of stubs are written in batches of REPLACE_MAX_IOVECS.
+    output_cursor cursor = {0, 0};
+    while(cursor.stub_index <= template->stub_count) {
+        int iovecs_count = next_output_pieces(template, values, &cursor,
+                                              iovecs, REPLACE_MAX_IOVECS);
+        if(!write_iovecs(output_fd, iovecs, iovecs_count)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+int compiled_template_iovecs(compiled_template* template, placeholder_values* values,
+                             struct iovec* iovecs, int max_iovecs) {
+    // NOTE(erick): Without values the template is copied as is.
+    if(!values) {
+        if(template->data_size == 0) {
+            return 0;
+        }
+        if(max_iovecs < 1) {
+            return -1;
+        }
+        iovecs[0].iov_base = template->data;
+        iovecs[0].iov_len = template->data_size;
+        return 1;
+    }
+
+    output_cursor cursor = {0, 0};
+    int iovecs_count = next_output_pieces(template, values, &cursor, iovecs, max_iovecs);
+    return (cursor.stub_index > template->stub_count) ? iovecs_count : -1;
+}
+
+// NOTE(erick): Tells if any piece of the output comes from the values
+// derived from the output name. Outputs that don't are the same whatever
+// they are called.
+bool compiled_template_uses_name(compiled_template* template, placeholder_values* values) {
+    if(!values) {
+        return FALSE;
+    }
+
+    char* derived_start = (char*) values->derived_values;
+    char* derived_end = derived_start + sizeof(values->derived_values);
+
+    struct iovec iovecs[COMPARE_MAX_IOVECS];
+    output_cursor cursor = {0, 0};
+    while(cursor.stub_index <= template->stub_count) {
+        int iovecs_count = next_output_pieces(template, values, &cursor,
+                                              iovecs, COMPARE_MAX_IOVECS);
+        for(int i = 0; i < iovecs_count; i++) {
+            char* piece = (char*) iovecs[i].iov_base;
+            if(piece >= derived_start && piece < derived_end) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+typedef struct {
+    int fd;
+    size_t used;
+    size_t available;
+    uint8 buffer[COMPARE_BUFFER_SIZE];
+} compare_reader;
+
+static bool reader_matches(compare_reader* reader, uint8* data, size_t data_len) {
+    while(data_len) {
+        if(reader->used == reader->available) {
+            ssize_t n_read = read(reader->fd, reader->buffer, COMPARE_BUFFER_SIZE);
+            STATS_SYSCALL(SYSCALL_READ);
+            if(n_read < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n_read <= 0) {
+                return FALSE;
+            }
+            STATS_BYTES_READ(n_read);
+            reader->used = 0;
+            reader->available = n_read;
+        }
+
+        size_t chunk_len = reader->available - reader->used;
+        if(chunk_len > data_len) {
+            chunk_len = data_len;
+        }
+        if(memcmp(reader->buffer + reader->used, data, chunk_len) != 0) {
+            return FALSE;
+        }
+
+        reader->used += chunk_len;
+        data += chunk_len;
+        data_len -= chunk_len;
+    }
+
+    return TRUE;
+}
+
+// NOTE(erick): Tells if the file open in fd already holds the output the
+// template would produce. A different size is enough to tell they differ,
+// otherwise the file is read once and compared piece by piece.
+bool compiled_template_matches(compiled_template* template, placeholder_values* values,
+                               int fd) {
+    struct iovec iovecs[COMPARE_MAX_IOVECS];
+    size_t output_size = template->data_size;
+    if(values) {
+        output_size = 0;
+        output_cursor cursor = {0, 0};
+        while(cursor.stub_index <= template->stub_count) {
+            int iovecs_count = next_output_pieces(template, values, &cursor,
+                                                  iovecs, COMPARE_MAX_IOVECS);
+            for(int i = 0; i < iovecs_count; i++) {
+                output_size += iovecs[i].iov_len;
+            }
+        }
+    }
+
+    // NOTE(erick): Outputs get the mode of their template (see
+    // open_output_file), one with another mode is written again too.
+    struct stat stat_buffer;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(fstat(fd, &stat_buffer) || !S_ISREG(stat_buffer.st_mode) ||
+       (stat_buffer.st_mode & 07777) != (template->mode & 07777) ||
+       (size_t) stat_buffer.st_size != output_size) {
+        return FALSE;
+    }
+
+    compare_reader reader;
+    reader.fd = fd;
+    reader.used = 0;
+    reader.available = 0;
+
+    if(!values) {
+        return reader_matches(&reader, template->data, template->data_size);
+    }
+
+    output_cursor cursor = {0, 0};
+    while(cursor.stub_index <= template->stub_count) {
+        int iovecs_count = next_output_pieces(template, values, &cursor,
+                                              iovecs, COMPARE_MAX_IOVECS);
+        for(int i = 0; i < iovecs_count; i++) {
+            if(!reader_matches(&reader, (uint8*) iovecs[i].iov_base, iovecs[i].iov_len)) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+void free_compiled_template(compiled_template* template) {
+    if(template->is_packed) {
+        memset(template, 0, sizeof(compiled_template));
+        return;
+    }
+
+    if(template->data) {
+        munmap(template->data, template->data_size);
+    }
+    release_memory(template->allocator, template->stub_offsets,
+                   template->stub_capacity * sizeof(size_t));
+
+    template->data = NULL;
+    template->stub_offsets = NULL;
+    template->stub_count = 0;
+    template->stub_capacity = 0;
+}
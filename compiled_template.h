@@ -0,0 +1,42 @@
+#ifndef COMPILED_TEMPLATE_H
+#define COMPILED_TEMPLATE_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "default_definitions.h"
+#include "allocator.h"
+#include "placeholders.h"
+#include "decompress.h"
+
+#define COMPARE_BUFFER_SIZE KILO(64)
+#define COMPARE_MAX_IOVECS 64
+
+// NOTE(erick): A template loaded once and split into literal spans.
+// There is a stub between every pair of consecutive spans, so an output
+// is written as: span[0] value span[1] value ... span[n]. A placeholder
+// takes the place of two stubs and the span between them.
+typedef struct {
+    char* template_file_path;
+    uint8* data;
+    size_t data_size;
+    mode_t mode;
+    size_t stub_len;
+    size_t* stub_offsets;
+    uint stub_count;
+    uint stub_capacity;
+    template_allocator* allocator;
+    // NOTE(erick): Packed templates point into a template pack, which owns
+    // their data and stub offsets.
+    bool is_packed;
+} compiled_template;
+
+bool compile_template(char*, int, char*, compression_format, compiled_template*,
+                      template_allocator*);
+bool write_compiled_template(compiled_template*, int, placeholder_values*);
+int compiled_template_iovecs(compiled_template*, placeholder_values*, struct iovec*, int);
+bool compiled_template_matches(compiled_template*, placeholder_values*, int);
+bool compiled_template_uses_name(compiled_template*, placeholder_values*);
+void free_compiled_template(compiled_template*);
+
+#endif
@@ -0,0 +1,198 @@
+/* Copies the contents of one file descriptor into another using the
+ * cheapest primitive the kernel offers us.
+ *
+ * The strategies are tried in order:
+ *   1. FICLONE reflink (btrfs, XFS, ...): metadata only, no data is copied.
+ *   2. copy_file_range: the data never leaves the kernel and some
+ *      filesystems (NFS 4.2, CIFS) can do a server-side copy.
+ *   3. sendfile: still in kernel, works across filesystems on older kernels.
+ *   4. A plain read/write loop with a big buffer.
+ *
+ * Every strategy but the reflink works on the current file offsets, so if one
+ * of them gives up half way the next one simply continues from where it stopped.
+ */
+
+#if LINUX
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if LINUX
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+#include "copy_engine.h"
+#include "stats.h"
+
+#define KERNEL_COPY_CHUNK MEGA(1024)
+
+// NOTE(erick): Any of these errors means "this primitive can't be used
+// with these files", not that the copy itself failed.
+#define is_unsupported_error(err) ((err) == ENOSYS     || \
+                                   (err) == EXDEV      || \
+                                   (err) == EINVAL     || \
+                                   (err) == EOPNOTSUPP || \
+                                   (err) == ENOTTY     || \
+                                   (err) == EBADF)
+
+#if LINUX
+static copy_strategy copy_with_kernel(int input_fd, int output_fd) {
+    STATS_SYSCALL(SYSCALL_COPY_RANGE);
+    if(ioctl(output_fd, FICLONE, input_fd) == 0) {
+        return COPY_STRATEGY_REFLINK;
+    }
+
+    // NOTE(erick): A signal before anything was moved is not an error,
+    // the call is just made again.
+    bool copied_anything = FALSE;
+    ssize_t n_copied;
+    while(TRUE) {
+        STATS_SYSCALL(SYSCALL_COPY_RANGE);
+        n_copied = copy_file_range(input_fd, NULL, output_fd, NULL, KERNEL_COPY_CHUNK, 0);
+        if(n_copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n_copied <= 0) {
+            break;
+        }
+        STATS_BYTES_READ(n_copied);
+        STATS_BYTES_WRITTEN(n_copied);
+        copied_anything = TRUE;
+    }
+
+    if(n_copied == 0 && copied_anything) {
+        return COPY_STRATEGY_COPY_FILE_RANGE;
+    }
+    if(n_copied < 0 && !is_unsupported_error(errno)) {
+        return COPY_STRATEGY_FAILED;
+    }
+
+    // NOTE(erick): copy_file_range returns 0 on some pseudo filesystems
+    // (e.g. procfs) even when there is data to read, so an empty first
+    // call is not trusted and we let sendfile have a go.
+    copied_anything = FALSE;
+    while(TRUE) {
+        STATS_SYSCALL(SYSCALL_COPY_RANGE);
+        n_copied = sendfile(output_fd, input_fd, NULL, KERNEL_COPY_CHUNK);
+        if(n_copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n_copied <= 0) {
+            break;
+        }
+        STATS_BYTES_READ(n_copied);
+        STATS_BYTES_WRITTEN(n_copied);
+        copied_anything = TRUE;
+    }
+
+    if(n_copied == 0 && copied_anything) {
+        return COPY_STRATEGY_SENDFILE;
+    }
+    if(n_copied < 0 && !is_unsupported_error(errno)) {
+        return COPY_STRATEGY_FAILED;
+    }
+
+    return COPY_STRATEGY_USERSPACE;
+}
+#endif
+
+static copy_strategy copy_with_buffer(int input_fd, int output_fd) {
+    uint8* buffer = (uint8*) malloc(COPY_BUFFER_SIZE);
+    if(!buffer) {
+        return COPY_STRATEGY_FAILED;
+    }
+
+    copy_strategy result = COPY_STRATEGY_USERSPACE;
+    while(TRUE) {
+        ssize_t n_read = read(input_fd, buffer, COPY_BUFFER_SIZE);
+        STATS_SYSCALL(SYSCALL_READ);
+        if(n_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n_read <= 0) {
+            if(n_read < 0) {
+                result = COPY_STRATEGY_FAILED;
+            }
+            break;
+        }
+        STATS_BYTES_READ(n_read);
+
+        uint8* cursor = buffer;
+        while(n_read > 0) {
+            ssize_t n_written = write(output_fd, cursor, n_read);
+            STATS_SYSCALL(SYSCALL_WRITE);
+            if(n_written < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n_written <= 0) {
+                free(buffer);
+                return COPY_STRATEGY_FAILED;
+            }
+            STATS_BYTES_WRITTEN(n_written);
+
+            cursor += n_written;
+            n_read -= n_written;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+copy_strategy copy_fd_contents(int input_fd, int output_fd) {
+#if LINUX
+    copy_strategy strategy = copy_with_kernel(input_fd, output_fd);
+    if(strategy != COPY_STRATEGY_USERSPACE) {
+        return strategy;
+    }
+#endif
+
+    return copy_with_buffer(input_fd, output_fd);
+}
+
+const char* copy_strategy_name(copy_strategy strategy) {
+    switch(strategy) {
+    case COPY_STRATEGY_REFLINK :
+        return "reflink";
+    case COPY_STRATEGY_COPY_FILE_RANGE :
+        return "copy_file_range";
+    case COPY_STRATEGY_SENDFILE :
+        return "sendfile";
+    case COPY_STRATEGY_USERSPACE :
+        return "userspace";
+    default :
+        return "failed";
+    }
+}
+
+bool write_iovecs(int output_fd, struct iovec* iovecs, int iovecs_count) {
+    while(iovecs_count > 0) {
+        ssize_t n_written = writev(output_fd, iovecs, iovecs_count);
+        STATS_SYSCALL(SYSCALL_WRITE);
+        if(n_written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n_written <= 0) {
+            return FALSE;
+        }
+        STATS_BYTES_WRITTEN(n_written);
+
+        // NOTE(erick): writev may stop anywhere, even in the middle of an iovec.
+        while(iovecs_count > 0 && (size_t) n_written >= iovecs->iov_len) {
+            n_written -= iovecs->iov_len;
+            iovecs++;
+            iovecs_count--;
+        }
+        if(iovecs_count > 0) {
+            iovecs->iov_base = (char*) iovecs->iov_base + n_written;
+            iovecs->iov_len -= n_written;
+        }
+    }
+
+    return TRUE;
+}
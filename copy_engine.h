@@ -0,0 +1,22 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H 1
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "default_definitions.h"
+
+#define COPY_BUFFER_SIZE MEGA(1)
+
+typedef enum {
+    COPY_STRATEGY_FAILED,
+    COPY_STRATEGY_REFLINK,
+    COPY_STRATEGY_COPY_FILE_RANGE,
+    COPY_STRATEGY_SENDFILE,
+    COPY_STRATEGY_USERSPACE
+} copy_strategy;
+
+copy_strategy copy_fd_contents(int, int);
+const char* copy_strategy_name(copy_strategy);
+bool write_iovecs(int, struct iovec*, int);
+
+#endif
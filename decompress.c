@@ -0,0 +1,255 @@
+/* Compressed templates: "header.h.gz" is the template for ".h" files.
+ *
+ * A compressed template is read and decompressed in chunks straight into
+ * an anonymous mapping, which then takes the place of the mapping of the
+ * file in its compiled template (see compiled_template.c). Everything
+ * after that (plain copies, replacements, io_uring, --update) works on the
+ * decompressed contents, nothing is staged in a temporary file, and only
+ * the compressed bytes are read from the disk.
+ *
+ * gzip (and zlib) files are always supported. zstd needs a build with
+ * -DTEMPLATE_ZSTD=1 and libzstd, otherwise ".zst" is just an extension.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#if TEMPLATE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decompress.h"
+#include "stats.h"
+
+typedef struct {
+    char* suffix;
+    compression_format format;
+} compression_suffix;
+
+static compression_suffix compression_suffixes[] = {
+    {".gz", COMPRESSION_GZIP},
+#if TEMPLATE_ZSTD
+    {".zst", COMPRESSION_ZSTD},
+#endif
+};
+
+typedef struct {
+    uint8* data;
+    size_t size;
+    size_t capacity;
+} output_mapping;
+
+// NOTE(erick): The format of a template from its name, and the length of
+// the suffix that says so. The name needs something before the suffix.
+compression_format template_compression(char* template_name, size_t* suffix_len) {
+    size_t name_len = strlen(template_name);
+    for(size_t i = 0; i < sizeof(compression_suffixes) / sizeof(compression_suffix); i++) {
+        size_t len = strlen(compression_suffixes[i].suffix);
+        if(name_len > len &&
+           strcmp(template_name + name_len - len, compression_suffixes[i].suffix) == 0) {
+            if(suffix_len) {
+                *suffix_len = len;
+            }
+            return compression_suffixes[i].format;
+        }
+    }
+
+    return COMPRESSION_NONE;
+}
+
+static bool grow_output_mapping(output_mapping* output) {
+    size_t new_capacity = output->capacity * 2;
+    void* new_data = mremap(output->data, output->capacity, new_capacity, MREMAP_MAYMOVE);
+    STATS_SYSCALL(SYSCALL_MMAP);
+    if(new_data == MAP_FAILED) {
+        return FALSE;
+    }
+
+    output->data = (uint8*) new_data;
+    output->capacity = new_capacity;
+    return TRUE;
+}
+
+static ssize_t read_compressed(int fd, uint8* buffer) {
+    ssize_t n_read;
+    do {
+        n_read = read(fd, buffer, DECOMPRESS_INPUT_SIZE);
+        STATS_SYSCALL(SYSCALL_READ);
+    } while(n_read < 0 && errno == EINTR);
+
+    if(n_read > 0) {
+        STATS_BYTES_READ(n_read);
+    }
+    return n_read;
+}
+
+// NOTE(erick): Several gzip members one after the other are a single file,
+// like gzip -d does.
+static bool inflate_template(int fd, uint8* input, output_mapping* output) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(z_stream));
+    // NOTE(erick): 32 lets zlib tell gzip and zlib headers apart.
+    if(inflateInit2(&stream, 15 + 32) != Z_OK) {
+        return FALSE;
+    }
+
+    bool result = FALSE;
+    bool reached_eof = FALSE;
+    int status = Z_OK;
+
+    while(TRUE) {
+        if(stream.avail_in == 0 && !reached_eof) {
+            ssize_t n_read = read_compressed(fd, input);
+            if(n_read < 0) {
+                break;
+            }
+            reached_eof = (n_read == 0);
+            stream.next_in = input;
+            stream.avail_in = n_read;
+        }
+
+        if(status == Z_STREAM_END) {
+            if(stream.avail_in == 0 && reached_eof) {
+                result = TRUE;
+                break;
+            }
+            if(stream.avail_in == 0) {
+                continue;
+            }
+            inflateReset(&stream);
+        }
+
+        if(output->size == output->capacity && !grow_output_mapping(output)) {
+            break;
+        }
+
+        stream.next_out = output->data + output->size;
+        stream.avail_out = output->capacity - output->size;
+        status = inflate(&stream, Z_NO_FLUSH);
+        output->size = stream.next_out - output->data;
+
+        if(status == Z_BUF_ERROR && stream.avail_in == 0 && reached_eof) {
+            break; // Truncated
+        }
+        if(status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            break;
+        }
+    }
+
+    inflateEnd(&stream);
+    return result;
+}
+
+#if TEMPLATE_ZSTD
+static bool unzstd_template(int fd, uint8* input, output_mapping* output) {
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    if(!context) {
+        return FALSE;
+    }
+
+    ZSTD_inBuffer in_buffer = {input, 0, 0};
+    bool result = FALSE;
+    bool reached_eof = FALSE;
+    // NOTE(erick): 0 once a frame is complete and flushed.
+    size_t status = 1;
+
+    while(TRUE) {
+        if(in_buffer.pos == in_buffer.size && !reached_eof) {
+            ssize_t n_read = read_compressed(fd, input);
+            if(n_read < 0) {
+                break;
+            }
+            reached_eof = (n_read == 0);
+            in_buffer.size = n_read;
+            in_buffer.pos = 0;
+        }
+
+        if(in_buffer.pos == in_buffer.size && reached_eof && status == 0) {
+            result = TRUE;
+            break;
+        }
+
+        if(output->size == output->capacity && !grow_output_mapping(output)) {
+            break;
+        }
+
+        size_t size_before = output->size;
+        ZSTD_outBuffer out_buffer = {output->data, output->capacity, output->size};
+        status = ZSTD_decompressStream(context, &out_buffer, &in_buffer);
+        if(ZSTD_isError(status)) {
+            break;
+        }
+        output->size = out_buffer.pos;
+
+        if(in_buffer.pos == in_buffer.size && reached_eof && status != 0 &&
+           output->size == size_before) {
+            break; // Truncated
+        }
+    }
+
+    ZSTD_freeDCtx(context);
+    return result;
+}
+#endif
+
+// NOTE(erick): The result is an anonymous mapping of exactly data_size
+// bytes, to be unmapped like the mapping of a file. compressed_size is
+// only a hint for the first size of the mapping.
+bool decompress_template(int fd, compression_format format, size_t compressed_size,
+                         uint8** data, size_t* data_size) {
+    output_mapping output;
+    output.size = 0;
+    output.capacity = DECOMPRESS_MIN_CAPACITY;
+    while(output.capacity < compressed_size * 4) {
+        output.capacity *= 2;
+    }
+
+    STATS_SYSCALL(SYSCALL_MMAP);
+    void* mapping = mmap(NULL, output.capacity, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint8* input = (uint8*) malloc(DECOMPRESS_INPUT_SIZE);
+    if(mapping == MAP_FAILED || !input) {
+        if(mapping != MAP_FAILED) {
+            munmap(mapping, output.capacity);
+        }
+        free(input);
+        return FALSE;
+    }
+    output.data = (uint8*) mapping;
+
+    bool result = FALSE;
+    if(format == COMPRESSION_GZIP) {
+        result = inflate_template(fd, input, &output);
+    }
+#if TEMPLATE_ZSTD
+    else if(format == COMPRESSION_ZSTD) {
+        result = unzstd_template(fd, input, &output);
+    }
+#endif
+    free(input);
+
+    *data = NULL;
+    *data_size = 0;
+    // NOTE(erick): An empty template is a template without data.
+    if(!result || output.size == 0) {
+        munmap(output.data, output.capacity);
+        return result;
+    }
+
+    // NOTE(erick): The spare capacity goes back, so unmapping data_size
+    // bytes frees all of it.
+    void* final_data = mremap(output.data, output.capacity, output.size, 0);
+    if(final_data == MAP_FAILED) {
+        munmap(output.data, output.capacity);
+        return FALSE;
+    }
+
+    *data = (uint8*) final_data;
+    *data_size = output.size;
+    return TRUE;
+}
@@ -0,0 +1,21 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H 1
+
+#include <stddef.h>
+#include "default_definitions.h"
+
+#define DECOMPRESS_INPUT_SIZE KILO(256)
+#define DECOMPRESS_MIN_CAPACITY KILO(64)
+
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+#if TEMPLATE_ZSTD
+    COMPRESSION_ZSTD,
+#endif
+} compression_format;
+
+compression_format template_compression(char*, size_t*);
+bool decompress_template(int, compression_format, size_t, uint8**, size_t*);
+
+#endif
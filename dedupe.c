@@ -0,0 +1,150 @@
+/* Outputs with the same contents are written only once.
+ *
+ * Two outputs are the same when they come from the same template with the
+ * same replace mode and string, and no piece of them is derived from their
+ * names (no "???" with -r, no ???NAME??? and so on). The first file of
+ * each group is generated as usual. The others are made from it once it is
+ * complete: cloned with the copy engine (a reflink where the file system
+ * has them, a copy inside the kernel otherwise) or, when asked, hard
+ * linked to it.
+ *
+ * Only templates kept in memory are looked at, every other file is
+ * generated on its own.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "template.h"
+#include "dedupe.h"
+#include "output_file.h"
+#include "stats.h"
+
+static uint64 hash_output(file_data* file, char* replace_string) {
+    uint64 hash = replace_string ? hash_string(replace_string) : 0;
+    hash ^= ((uint64) file->template_entry << 2) | file->replace;
+    return hash * 0x9E3779B97F4A7C15ULL;
+}
+
+// NOTE(erick): Returns how many files are the same as an earlier one.
+int find_duplicate_outputs(file_data* files, int files_count, dedupe_mode mode,
+                           template_allocator* allocator) {
+    if(mode == DEDUPE_NONE || files_count < 2) {
+        return 0;
+    }
+
+    // NOTE(erick): At most half of the slots are used.
+    uint slots_count = 16;
+    while(slots_count < 2 * (uint) files_count) {
+        slots_count *= 2;
+    }
+    uint slots_mask = slots_count - 1;
+
+    dedupe_slot* slots = (dedupe_slot*) allocate_zeroed(allocator, slots_count,
+                                                        sizeof(dedupe_slot));
+    if(!slots) {
+        return 0;
+    }
+
+    int duplicates_count = 0;
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* file = files + file_index;
+        file->same_output_as = NULL;
+        file->dedupe = mode;
+
+        placeholder_values values_buffer;
+        placeholder_values* values = get_placeholder_values(file, &values_buffer);
+        if(file->failed || !file->compiled_template ||
+           compiled_template_uses_name(file->compiled_template, values)) {
+            continue;
+        }
+
+        char* replace_string = (file->replace == REPLACE_WITH_ARGUMENT) ?
+            file->replace_string : NULL;
+        uint64 hash = hash_output(file, replace_string);
+        uint slot_index = hash & slots_mask;
+        dedupe_slot* slot = slots + slot_index;
+
+        while(slot->first_file &&
+              (slot->hash != hash || slot->template_entry != file->template_entry ||
+               slot->replace != (int) file->replace ||
+               (replace_string && strcmp(slot->replace_string, replace_string) != 0))) {
+            slot_index = (slot_index + 1) & slots_mask;
+            slot = slots + slot_index;
+        }
+
+        if(slot->first_file) {
+            file->same_output_as = slot->first_file;
+            duplicates_count++;
+        } else {
+            slot->first_file = file;
+            slot->hash = hash;
+            slot->template_entry = file->template_entry;
+            slot->replace = file->replace;
+            slot->replace_string = replace_string;
+        }
+    }
+
+    release_memory(allocator, slots, slots_count * sizeof(dedupe_slot));
+    return duplicates_count;
+}
+
+static template_error clone_output_file(file_data* file, char* source_path) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int source_fd = open(source_path, O_RDONLY | O_CLOEXEC);
+    if(source_fd < 0) {
+        return TEMPLATE_OPEN_TEMPLATE_FAILED;
+    }
+
+    output_file output;
+    template_error error = open_output_file(file->file_path, file->compiled_template->mode,
+                                            file->can_override, &output);
+    if(error == TEMPLATE_OK) {
+        output.start_writeback = (file->durability == DURABILITY_FILE);
+        output.keep_fd = output.start_writeback ? &file->output_fd : NULL;
+        bool written = copy_fd_contents(source_fd, output.fd) != COPY_STRATEGY_FAILED;
+        error = close_output_file(&output, file->file_path, written);
+    }
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(source_fd);
+    return error;
+}
+
+// NOTE(erick): Makes the file from the one with the same output. If that
+// one was left alone because it already existed, or the file can't be made
+// from it (e.g. it is on another file system), the file is generated on
+// its own.
+bool copy_duplicate_file(file_data* file) {
+    file_data* source = file->same_output_as;
+    if(file->failed) {
+        return FALSE;
+    }
+    if(source->error != TEMPLATE_OK && source->error != TEMPLATE_UNCHANGED) {
+        return copy_file(file);
+    }
+
+    STATS_TIMER(file_timer);
+
+    placeholder_values values_buffer;
+    if(output_is_unchanged(file, get_placeholder_values(file, &values_buffer))) {
+        STATS_FILE(file_timer);
+        return TRUE;
+    }
+
+    template_error error;
+    if(file->dedupe == DEDUPE_HARDLINK) {
+        error = link_output_file(source->file_path, file->file_path, file->can_override);
+    } else {
+        error = clone_output_file(file, source->file_path);
+    }
+    STATS_FILE(file_timer);
+
+    if(template_error_is_failure(error)) {
+        return copy_file(file);
+    }
+
+    set_file_error(file, error);
+    return TRUE;
+}
@@ -0,0 +1,29 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H 1
+
+#include "default_definitions.h"
+#include "allocator.h"
+
+typedef enum {
+    DEDUPE_NONE,
+    DEDUPE_REFLINK,
+    DEDUPE_HARDLINK
+} dedupe_mode;
+
+// NOTE(erick): Files with the same output as another file of the batch
+// point to it with same_output_as (see template.h) and are made from it
+// once it is written.
+typedef struct {
+    int template_entry;
+    int replace;
+    char* replace_string;
+    uint64 hash;
+    struct file_data* first_file;
+} dedupe_slot;
+
+struct file_data;
+
+int find_duplicate_outputs(struct file_data*, int, dedupe_mode, template_allocator*);
+bool copy_duplicate_file(struct file_data*);
+
+#endif
@@ -18,7 +18,7 @@ typedef int bool;
 #define FALSE 0
 #define TRUE  1
 
-#define KILO(n) (1024 * n)
-#define MEGA(n) (KILO(n))
+#define KILO(n) (1024 * (n))
+#define MEGA(n) (1024 * KILO(n))
 
 #endif
@@ -0,0 +1,252 @@
+/* Outputs that survive a crash (--durability).
+ *
+ * none, the default, leaves the outputs to the writeback of the kernel
+ * like cp does.
+ *
+ * batch syncs each file system that got outputs once, after all of them
+ * are written: one syncfs per file system however many files there are.
+ * It also writes back whatever else is dirty on those file systems.
+ *
+ * file makes every output durable on its own. Its writeback is started as
+ * soon as it is complete (see commit_output_file), so the disk works while
+ * the other outputs are generated, and it is only waited for at the end:
+ * every output is fsynced through the fd it was written with (kept open
+ * by keep_output_file), by then mostly waiting for writes already in
+ * flight, and so is every directory that got a new name. Outputs without
+ * a kept fd were synced when they were written, or are hard links to one
+ * that was.
+ *
+ * An output that could not be synced is reported as a write failure.
+ * Scaffolds are whole trees, their file system gets a syncfs either way.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "template.h"
+#include "durability.h"
+#include "output_file.h"
+#include "stats.h"
+
+typedef struct {
+    file_data* files;
+    int* file_directories;
+} durability_batch;
+
+// NOTE(erick): Outputs left alone (they existed or were up to date) were
+// not written by us.
+static bool output_was_written(file_data* file) {
+    return file->error == TEMPLATE_OK || file->error == TEMPLATE_MODE_NOT_SET;
+}
+
+// NOTE(erick): Puts the slot of the directory of path, added if it is
+// new, in slot.
+static template_error find_directory(durability_directory* directories, uint slots_mask,
+                                     char* path, template_allocator* allocator, int* slot) {
+    char directory_path[PATH_MAX];
+    if(!output_directory(path, directory_path, sizeof(directory_path))) {
+        return TEMPLATE_PATH_TOO_LONG;
+    }
+
+    uint64 hash = hash_string(directory_path);
+    uint slot_index = hash & slots_mask;
+    durability_directory* directory = directories + slot_index;
+    while(directory->path &&
+          (directory->hash != hash || strcmp(directory->path, directory_path) != 0)) {
+        slot_index = (slot_index + 1) & slots_mask;
+        directory = directories + slot_index;
+    }
+
+    if(!directory->path) {
+        size_t path_size = strlen(directory_path) + 1;
+        directory->path = (char*) allocate_memory(allocator, path_size);
+        if(!directory->path) {
+            return TEMPLATE_NO_MEMORY;
+        }
+        memcpy(directory->path, directory_path, path_size);
+        directory->hash = hash;
+    }
+
+    *slot = (int) slot_index;
+    return TEMPLATE_OK;
+}
+
+static void close_kept_outputs(file_data* files, int files_count) {
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        if(files[file_index].output_fd >= 0) {
+            close_kept_output(files[file_index].output_fd);
+            files[file_index].output_fd = -1;
+        }
+    }
+}
+
+// NOTE(erick): fsync waits for the writeback started when the output was
+// committed, and also writes its size and blocks.
+static void sync_output_work(void* data, int file_index) {
+    durability_batch* batch = (durability_batch*) data;
+    file_data* file = batch->files + file_index;
+    if(file->output_fd < 0) {
+        return;
+    }
+
+    if(batch->file_directories[file_index] >= 0) {
+        STATS_SYSCALL(SYSCALL_SYNC);
+        if(fsync(file->output_fd)) {
+            set_file_error(file, TEMPLATE_WRITE_FAILED);
+        }
+    }
+
+    close_kept_output(file->output_fd);
+    file->output_fd = -1;
+}
+
+// NOTE(erick): A file system is synced once, through the first of its
+// directories. If there are more file systems than we keep track of the
+// rest are synced once per directory, which is slower but still right.
+static bool sync_filesystem(int directory_fd, durability_filesystem* filesystems,
+                            int* filesystems_count) {
+    struct stat stat_buffer;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(fstat(directory_fd, &stat_buffer)) {
+        return FALSE;
+    }
+
+    for(int i = 0; i < *filesystems_count; i++) {
+        if(filesystems[i].device == stat_buffer.st_dev) {
+            return !filesystems[i].failed;
+        }
+    }
+
+    STATS_SYSCALL(SYSCALL_SYNC);
+    bool synced = (syncfs(directory_fd) == 0);
+    if(*filesystems_count < DURABILITY_MAX_FILESYSTEMS) {
+        filesystems[*filesystems_count].device = stat_buffer.st_dev;
+        filesystems[*filesystems_count].failed = !synced;
+        (*filesystems_count)++;
+    }
+
+    return synced;
+}
+
+static void sync_directory(durability_directory* directory, durability_mode mode,
+                           durability_filesystem* filesystems, int* filesystems_count) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int directory_fd = open(directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directory_fd < 0) {
+        directory->failed = TRUE;
+        return;
+    }
+
+    if(mode == DURABILITY_FILE) {
+        STATS_SYSCALL(SYSCALL_SYNC);
+        directory->failed = (fsync(directory_fd) != 0);
+    }
+
+    if((mode == DURABILITY_BATCH || directory->needs_syncfs) &&
+       !sync_filesystem(directory_fd, filesystems, filesystems_count)) {
+        directory->failed = TRUE;
+    }
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(directory_fd);
+}
+
+static void release_durability_memory(durability_directory* directories, uint slots_count,
+                                     int* file_directories, int files_count,
+                                     template_allocator* allocator) {
+    if(directories) {
+        for(uint slot_index = 0; slot_index < slots_count; slot_index++) {
+            char* path = directories[slot_index].path;
+            if(path) {
+                release_memory(allocator, path, strlen(path) + 1);
+            }
+        }
+    }
+    release_memory(allocator, directories, slots_count * sizeof(durability_directory));
+    release_memory(allocator, file_directories, files_count * sizeof(int));
+}
+
+void make_outputs_durable(file_data* files, int files_count, durability_mode mode,
+                          int workers_count) {
+    if(mode == DURABILITY_NONE || files_count < 1) {
+        return;
+    }
+
+    // NOTE(erick): All of this is scratch memory, freed in no particular
+    // order, so it comes from the heap. An arena would only get it back at
+    // the end of the run, once per manifest batch.
+    template_allocator* allocator = default_allocator();
+
+    // NOTE(erick): At most half of the slots are used.
+    uint slots_count = 16;
+    while(slots_count < 2 * (uint) files_count) {
+        slots_count *= 2;
+    }
+    uint slots_mask = slots_count - 1;
+
+    durability_directory* directories = (durability_directory*) allocate_zeroed(
+        allocator, slots_count, sizeof(durability_directory));
+    int* file_directories = (int*) allocate_memory(allocator, files_count * sizeof(int));
+    bool has_memory = directories && file_directories;
+
+    // NOTE(erick): An output we can't sync is not durable, it is reported.
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* file = files + file_index;
+        int directory_index = -1;
+        if(output_was_written(file)) {
+            template_error error = TEMPLATE_NO_MEMORY;
+            if(has_memory) {
+                error = find_directory(directories, slots_mask, file->file_path,
+                                       allocator, &directory_index);
+            }
+            if(error != TEMPLATE_OK) {
+                set_file_error(file, error);
+            }
+        }
+        if(file_directories) {
+            file_directories[file_index] = directory_index;
+        }
+    }
+
+    if(!has_memory) {
+        close_kept_outputs(files, files_count);
+        release_durability_memory(directories, slots_count, file_directories,
+                                  files_count, allocator);
+        return;
+    }
+
+    if(mode == DURABILITY_FILE) {
+        durability_batch batch = {files, file_directories};
+        run_in_parallel(sync_output_work, &batch, files_count, workers_count);
+
+        for(int file_index = 0; file_index < files_count; file_index++) {
+            int directory_index = file_directories[file_index];
+            if(files[file_index].is_scaffold && directory_index >= 0) {
+                directories[directory_index].needs_syncfs = TRUE;
+            }
+        }
+    }
+
+    durability_filesystem filesystems[DURABILITY_MAX_FILESYSTEMS];
+    int filesystems_count = 0;
+    for(uint slot_index = 0; slot_index < slots_count; slot_index++) {
+        if(directories[slot_index].path) {
+            sync_directory(directories + slot_index, mode, filesystems, &filesystems_count);
+        }
+    }
+
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        int directory_index = file_directories[file_index];
+        if(directory_index >= 0 && directories[directory_index].failed) {
+            set_file_error(files + file_index, TEMPLATE_WRITE_FAILED);
+        }
+    }
+
+    release_durability_memory(directories, slots_count, file_directories,
+                              files_count, allocator);
+}
@@ -0,0 +1,34 @@
+#ifndef DURABILITY_H
+#define DURABILITY_H 1
+
+#include <sys/types.h>
+#include "default_definitions.h"
+#include "allocator.h"
+
+#define DURABILITY_MAX_FILESYSTEMS 16
+
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_BATCH,
+    DURABILITY_FILE
+} durability_mode;
+
+// NOTE(erick): A directory that got outputs. Each one is opened once, to
+// fsync it and to find its file system.
+typedef struct {
+    char* path;
+    uint64 hash;
+    bool needs_syncfs;
+    bool failed;
+} durability_directory;
+
+typedef struct {
+    dev_t device;
+    bool failed;
+} durability_filesystem;
+
+struct file_data;
+
+void make_outputs_durable(struct file_data*, int, durability_mode, int);
+
+#endif
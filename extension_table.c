@@ -0,0 +1,91 @@
+/* Groups the requested files by extension in an open addressing hash
+ * table, so each template name costs a lookup per dot in it instead of a
+ * comparison against every requested file.
+ */
+
+#include <string.h>
+
+#include "template.h"
+#include "extension_table.h"
+
+bool build_extension_table(file_data* files, int files_count,
+                           extension_table* table, template_allocator* allocator) {
+    // NOTE(erick): At most half of the slots are used.
+    uint slots_count = 16;
+    while(slots_count < 2 * (uint) files_count) {
+        slots_count *= 2;
+    }
+
+    table->allocator = allocator;
+    table->files_count = files_count;
+    table->slots = (extension_slot*) allocate_zeroed(allocator, slots_count,
+                                                     sizeof(extension_slot));
+    table->next_file = (int*) allocate_memory(allocator, (files_count + 1) * sizeof(int));
+    table->slots_mask = slots_count - 1;
+
+    if(!table->slots || !table->next_file) {
+        free_extension_table(table);
+        return FALSE;
+    }
+
+    // NOTE(erick): Files are inserted backwards so each slot lists its
+    // files in the original order.
+    for(int file_index = files_count - 1; file_index >= 0; file_index--) {
+        char* extension = files[file_index].file_extension;
+
+        // NOTE(erick): We do not support template files without extension
+        if(!extension || *extension == '\0') {
+            continue;
+        }
+
+        uint64 hash = hash_string(extension);
+        uint slot_index = hash & table->slots_mask;
+        extension_slot* slot = table->slots + slot_index;
+
+        while(slot->extension &&
+              (slot->hash != hash || strcmp(slot->extension, extension) != 0)) {
+            slot_index = (slot_index + 1) & table->slots_mask;
+            slot = table->slots + slot_index;
+        }
+
+        if(!slot->extension) {
+            slot->extension = extension;
+            slot->hash = hash;
+            slot->first_file = NO_FILE;
+        }
+
+        table->next_file[file_index] = slot->first_file;
+        slot->first_file = file_index;
+        slot->files_count++;
+    }
+
+    return TRUE;
+}
+
+extension_slot* find_extension_slot(extension_table* table, char* extension) {
+    uint64 hash = hash_string(extension);
+    uint slot_index = hash & table->slots_mask;
+    extension_slot* slot = table->slots + slot_index;
+
+    while(slot->extension) {
+        if(slot->hash == hash && strcmp(slot->extension, extension) == 0) {
+            return slot;
+        }
+
+        slot_index = (slot_index + 1) & table->slots_mask;
+        slot = table->slots + slot_index;
+    }
+
+    return NULL;
+}
+
+void free_extension_table(extension_table* table) {
+    // NOTE(erick): In the reverse order of the allocations, so an arena
+    // can take the memory back.
+    release_memory(table->allocator, table->next_file,
+                   (table->files_count + 1) * sizeof(int));
+    release_memory(table->allocator, table->slots,
+                   (table->slots_mask + 1) * sizeof(extension_slot));
+    table->slots = NULL;
+    table->next_file = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef EXTENSION_TABLE_H
+#define EXTENSION_TABLE_H 1
+
+#include "default_definitions.h"
+#include "allocator.h"
+
+#define NO_FILE (-1)
+
+// NOTE(erick): All the files asking for the same extension share a slot.
+// The files of a slot are linked through next_file, starting at first_file.
+typedef struct {
+    char* extension;
+    uint64 hash;
+    int first_file;
+    int files_count;
+} extension_slot;
+
+typedef struct {
+    extension_slot* slots;
+    uint slots_mask;
+    int* next_file;
+    int files_count;
+    template_allocator* allocator;
+} extension_table;
+
+struct file_data;
+
+bool build_extension_table(struct file_data*, int, extension_table*,
+                           template_allocator*);
+extension_slot* find_extension_slot(extension_table*, char*);
+void free_extension_table(extension_table*);
+
+#endif
@@ -0,0 +1,909 @@
+/* The core of template: finding the template of a file and generating the
+ * file from it. The command line tool (template.c) and the library API
+ * (libtemplate.h) are both built on top of it.
+ *
+ * Nothing in here exits the process. Per-file problems are recorded in
+ * the file_data with set_file_error and everything that outlives a call
+ * is allocated through the template_allocator of the lookup.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "template.h"
+#include "string_buffer.h"
+#include "stats.h"
+#include "output_file.h"
+#include "scaffold.h"
+#include "decompress.h"
+
+struct template_context {
+    template_allocator allocator;
+    char template_dir_name[MAX_DIR_NAME];
+    template_lookup lookup;
+    placeholder_set placeholders;
+};
+
+inline void trim_right(char* str){
+    int len = strlen(str);
+
+    int i  = len - 1;
+
+    while( i >= 0 &&
+           ( str[i] == '\n' ||
+             str[i] == '\t' ||
+             str[i] == ' ')) {
+        str[i--] = '\0';
+    }
+}
+
+inline char* copy_string(char* dest, char* src){
+    //NOTE: copies all the characters from src to dest and
+    //returns a pointer to last character of dest.
+
+    while(*src) {
+        *dest++ = *src++;
+    }
+
+    *dest++ = '\0';
+    return dest;
+}
+
+// NOTE(erick): FNV-1a. Used for the template index file names and
+// the extension table.
+uint64 hash_string(char* str) {
+    uint64 hash = 14695981039346656037ULL;
+    while(*str) {
+        hash ^= (uint8) *str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+void get_files_extensions(file_data* files_to_output, int files_to_output_count) {
+    // NOTE(erick): The extension is everything after the first dot of the
+    // filename (e.g. "test.cpp" for "foo.test.cpp"). The template lookup
+    // then uses the longest part of it that some template provides.
+    // A leading dot (hidden files) does not start an extension.
+    for(int i = 0; i < files_to_output_count; i++){
+        if(files_to_output[i].file_extension == NULL) {
+            char* filename = files_to_output[i].filename;
+            char* dot = *filename ? strchr(filename + 1, '.') : NULL;
+            if(!dot) {
+                set_file_error(files_to_output + i, TEMPLATE_NO_EXTENSION);
+                continue;
+            }
+
+            files_to_output[i].file_extension = dot + 1;
+        }
+    }
+}
+
+void get_files_names(file_data* files, int files_count) {
+    // NOTE(erick): The filename is what follows the last '/'. The command
+    // line tool always has one (relative paths get the destination dir in
+    // front of them), but library callers can pass a bare name like "a.h",
+    // which is the filename itself.
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* current_file = files + file_index;
+        if(*current_file->file_path == '\0') {
+            current_file->filename = current_file->file_path;
+            set_file_error(current_file, TEMPLATE_INVALID_ARGUMENT);
+            continue;
+        }
+
+        char* last_slash = strrchr(current_file->file_path, '/');
+        current_file->filename = last_slash ? last_slash + 1 : current_file->file_path;
+    }
+}
+
+// NOTE(erick): Expands a value from user-dirs.dirs into dest. The file is
+// meant to be sourced by sh, but the spec only allows "$HOME/..." or
+// "/..." between double quotes, with '\\' escaping '"', '$', '`' and '\\'.
+static bool expand_user_dir_value(char* value, char* home, char* dest) {
+    char* dest_end = dest + MAX_DIR_NAME - 1;
+
+    if(*value++ != '"') {
+        return FALSE;
+    }
+
+    if(strncmp(value, "$HOME", strlen("$HOME")) == 0) {
+        if(!home) {
+            return FALSE;
+        }
+        value += strlen("$HOME");
+        while(*home && dest < dest_end) {
+            *dest++ = *home++;
+        }
+    } else if(!is_absolute_path(value)) {
+        return FALSE;
+    }
+
+    while(*value && *value != '"' && dest < dest_end) {
+        if(*value == '\\' && value[1]) {
+            value++;
+        }
+        *dest++ = *value++;
+    }
+    *dest = '\0';
+
+    return *value == '"';
+}
+
+static bool read_user_dirs_file(char* template_dir_name_buffer) {
+    char user_dirs_path[PATH_MAX];
+    char* xdg_config_home = getenv("XDG_CONFIG_HOME");
+    char* home = getenv("HOME");
+
+    if(xdg_config_home && is_absolute_path(xdg_config_home)) {
+        snprintf(user_dirs_path, PATH_MAX, "%s/user-dirs.dirs", xdg_config_home);
+    } else if(home) {
+        snprintf(user_dirs_path, PATH_MAX, "%s/.config/user-dirs.dirs", home);
+    } else {
+        return FALSE;
+    }
+
+    FILE* user_dirs = fopen(user_dirs_path, "r");
+    if(!user_dirs) {
+        return FALSE;
+    }
+
+    bool found = FALSE;
+    StringBuffer string_buffer;
+    string_buffer_init(&string_buffer);
+
+    // NOTE(erick): Like the shell, the last assignment wins.
+    while(string_buffer_read_line(user_dirs, &string_buffer)) {
+        char* line = string_buffer.buffer_data;
+        while(*line == ' ' || *line == '\t') {
+            line++;
+        }
+
+        if(strncmp(line, XDG_TEMPLATES_VAR "=", strlen(XDG_TEMPLATES_VAR "=")) == 0) {
+            trim_right(line);
+            found = expand_user_dir_value(line + strlen(XDG_TEMPLATES_VAR "="),
+                                          home, template_dir_name_buffer);
+        }
+    }
+
+    free_string_buffer(&string_buffer);
+    fclose(user_dirs);
+    return found;
+}
+
+bool get_template_dir(char* template_dir_name_buffer, char* template_dir_override) {
+    // NOTE(erick): Running xdg-user-dir costs a fork and exec of a shell,
+    // so we resolve the directory ourselves: -t, $TEMPLATE_DIR,
+    // user-dirs.dirs, $XDG_TEMPLATES_DIR and finally $HOME, which is the
+    // same order xdg-user-dir uses after the first two.
+    if(!template_dir_override) {
+        template_dir_override = getenv(TEMPLATE_DIR_VAR);
+    }
+
+    if(template_dir_override && *template_dir_override) {
+        snprintf(template_dir_name_buffer, MAX_DIR_NAME, "%s", template_dir_override);
+        return TRUE;
+    }
+
+    if(read_user_dirs_file(template_dir_name_buffer)) {
+        return TRUE;
+    }
+
+    char* fallback = getenv(XDG_TEMPLATES_VAR);
+    if(!fallback || !*fallback) {
+        fallback = getenv("HOME");
+    }
+
+    if(!fallback || !*fallback) {
+        return FALSE;
+    }
+
+    snprintf(template_dir_name_buffer, MAX_DIR_NAME, "%s", fallback);
+    return TRUE;
+}
+
+template_error init_template_lookup(template_lookup* lookup, char* template_dir_name,
+                                    bool rebuild_index, template_allocator* allocator) {
+    memset(lookup, 0, sizeof(template_lookup));
+    lookup->template_dir_name = template_dir_name;
+    lookup->rebuild_index = rebuild_index;
+    lookup->allocator = allocator;
+
+    // NOTE(erick): A template directory that is a regular file is a pack
+    // made with --pack, see template_pack.c.
+    if(!load_template_index(template_dir_name, rebuild_index, &lookup->index, allocator)) {
+        if(!load_template_pack(template_dir_name, &lookup->pack)) {
+            return TEMPLATE_NO_TEMPLATE_DIR;
+        }
+        if(!load_pack_index(&lookup->pack, &lookup->index, allocator)) {
+            free_template_pack(&lookup->pack);
+            return TEMPLATE_NO_TEMPLATE_DIR;
+        }
+    }
+
+    uint template_count = lookup->index.template_count;
+
+    // NOTE(erick): Templates of a pack are never decompressed, the pack
+    // has the decompressed ones as templates of their own.
+    uint compressed_count = 0;
+    for(uint entry = 0; !lookup->pack.data && entry < template_count; entry++) {
+        compressed_count += template_compression(lookup->index.template_names[entry],
+                                                 NULL) != COMPRESSION_NONE;
+    }
+    lookup->entries_count = template_count + compressed_count;
+    uint entries_count = lookup->entries_count;
+
+    // NOTE(erick): Full paths and compiled templates are only made for the
+    // templates actually used, and are kept for the whole run.
+    lookup->template_full_paths = (char**) allocate_zeroed(allocator, entries_count + 1,
+                                                           sizeof(char*));
+    lookup->compiled_templates = (compiled_template**) allocate_zeroed(
+        allocator, entries_count + 1, sizeof(compiled_template*));
+    lookup->compile_attempted = (bool*) allocate_zeroed(allocator, entries_count + 1,
+                                                        sizeof(bool));
+    lookup->decompressed_sources = (uint*) allocate_zeroed(allocator, compressed_count + 1,
+                                                           sizeof(uint));
+
+    bool initialized = lookup->template_full_paths &&
+        lookup->compiled_templates &&
+        lookup->compile_attempted &&
+        lookup->decompressed_sources &&
+        suffix_trie_init(&lookup->trie, allocator);
+
+    // NOTE(erick): Every template goes by its own name, so a gzip file can
+    // still be the template of ".tar.gz" outputs. Compressed templates also
+    // go by the name inside the suffix ("header.h" for "header.h.gz"),
+    // decompressed. Those are inserted last, so a template that matches
+    // by its own name wins over one that is decompressed.
+    for(uint entry = 0; initialized && entry < template_count; entry++) {
+        initialized = suffix_trie_insert_template(&lookup->trie,
+                                                  lookup->index.template_names[entry],
+                                                  entry);
+    }
+
+    uint decompressed_entry = template_count;
+    for(uint entry = 0; initialized && decompressed_entry < entries_count; entry++) {
+        char* template_name = lookup->index.template_names[entry];
+        size_t suffix_len;
+        if(template_compression(template_name, &suffix_len) == COMPRESSION_NONE) {
+            continue;
+        }
+
+        lookup->decompressed_sources[decompressed_entry - template_count] = entry;
+        char inner_name[NAME_MAX + 1];
+        size_t inner_len = strlen(template_name) - suffix_len;
+        if(inner_len < sizeof(inner_name)) {
+            memcpy(inner_name, template_name, inner_len);
+            inner_name[inner_len] = '\0';
+            initialized = suffix_trie_insert_template(&lookup->trie, inner_name,
+                                                      decompressed_entry);
+        }
+        decompressed_entry++;
+    }
+
+    if(!initialized) {
+        free_template_lookup(lookup);
+        return TEMPLATE_NO_MEMORY;
+    }
+
+    return TEMPLATE_OK;
+}
+
+void free_template_lookup(template_lookup* lookup) {
+    template_allocator* allocator = lookup->allocator;
+    uint template_count = lookup->index.template_count;
+    uint entries_count = lookup->entries_count;
+
+    for(uint entry = 0; entry < entries_count; entry++) {
+        if(lookup->template_full_paths && lookup->template_full_paths[entry]) {
+            char* full_path = lookup->template_full_paths[entry];
+            release_memory(allocator, full_path, strlen(full_path) + 1);
+        }
+        if(lookup->compiled_templates && lookup->compiled_templates[entry]) {
+            free_compiled_template(lookup->compiled_templates[entry]);
+            release_memory(allocator, lookup->compiled_templates[entry],
+                           sizeof(compiled_template));
+        }
+    }
+
+    release_memory(allocator, lookup->template_full_paths,
+                   (entries_count + 1) * sizeof(char*));
+    release_memory(allocator, lookup->compiled_templates,
+                   (entries_count + 1) * sizeof(compiled_template*));
+    release_memory(allocator, lookup->compile_attempted,
+                   (entries_count + 1) * sizeof(bool));
+    release_memory(allocator, lookup->decompressed_sources,
+                   (entries_count - template_count + 1) * sizeof(uint));
+    if(lookup->trie.nodes || lookup->trie.edges) {
+        free_suffix_trie(&lookup->trie);
+    }
+    free_template_index(&lookup->index);
+    free_template_pack(&lookup->pack);
+
+    lookup->template_full_paths = NULL;
+    lookup->compiled_templates = NULL;
+    lookup->compile_attempted = NULL;
+    lookup->decompressed_sources = NULL;
+}
+
+// NOTE(erick): The entry of the index a lookup entry reads from.
+static uint template_source_entry(template_lookup* lookup, int entry) {
+    uint template_count = lookup->index.template_count;
+    return ((uint) entry < template_count) ? (uint) entry :
+        lookup->decompressed_sources[entry - template_count];
+}
+
+static compression_format template_entry_compression(template_lookup* lookup, int entry) {
+    if((uint) entry < lookup->index.template_count) {
+        return COMPRESSION_NONE;
+    }
+    char* template_name = lookup->index.template_names[template_source_entry(lookup, entry)];
+    return template_compression(template_name, NULL);
+}
+
+// NOTE(erick): Returns NULL if we run out of memory.
+static char* get_template_full_path(template_lookup* lookup, int entry) {
+    char* template_file_full_path = lookup->template_full_paths[entry];
+
+    if(template_file_full_path == NULL) {
+        char* current_template_filename =
+            lookup->index.template_names[template_source_entry(lookup, entry)];
+        size_t template_dir_name_len = strlen(lookup->template_dir_name);
+        size_t template_filename_len = strlen(current_template_filename);
+
+        template_file_full_path = allocate_string(lookup->allocator,
+                                                  template_dir_name_len + 1 +
+                                                  template_filename_len);
+        if(!template_file_full_path) {
+            return NULL;
+        }
+
+        memcpy(template_file_full_path, lookup->template_dir_name, template_dir_name_len);
+        template_file_full_path[template_dir_name_len] = '/';
+        memcpy(template_file_full_path + template_dir_name_len + 1,
+               current_template_filename, template_filename_len + 1);
+        lookup->template_full_paths[entry] = template_file_full_path;
+    }
+
+    return template_file_full_path;
+}
+
+// NOTE(erick): Asks the kernel to start reading the template in the
+// background (posix_fadvise WILLNEED is readahead(2) on Linux), so the
+// disk reads of the templates of later files overlap with copying the
+// earlier ones. Past TEMPLATE_PREFETCH_SIZE the normal readahead of the
+// copy takes over. The descriptor is kept for the first read of the
+// template, so prefetching costs no extra open.
+static int prefetch_template(char* template_path) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int template_fd = open(template_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(template_fd >= 0) {
+        STATS_SYSCALL(SYSCALL_FADVISE);
+        posix_fadvise(template_fd, 0, TEMPLATE_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+    }
+    return template_fd;
+}
+
+void close_prefetched_templates(file_data* files, int files_count) {
+    for(int i = 0; i < files_count; i++) {
+        if(files[i].template_fd >= 0) {
+            STATS_SYSCALL(SYSCALL_CLOSE);
+            close(files[i].template_fd);
+            files[i].template_fd = -1;
+        }
+    }
+}
+
+void get_template_files(file_data* files, int files_count, template_lookup* lookup) {
+    for(int i = 0; i < files_count; i++) {
+        files[i].template_entry = NO_TEMPLATE;
+        files[i].template_fd = -1;
+        files[i].output_fd = -1;
+        files[i].is_scaffold = FALSE;
+    }
+
+    extension_table table;
+    if(!build_extension_table(files, files_count, &table, lookup->allocator)) {
+        for(int i = 0; i < files_count; i++) {
+            if(!files[i].failed) {
+                set_file_error(files + i, TEMPLATE_NO_MEMORY);
+            }
+        }
+        return;
+    }
+
+    for(uint slot_index = 0; slot_index <= table.slots_mask; slot_index++) {
+        extension_slot* slot = table.slots + slot_index;
+        if(!slot->extension) {
+            continue;
+        }
+
+        int entry = suffix_trie_find_template(&lookup->trie, slot->extension);
+        compression_format compression = (entry == NO_TEMPLATE) ? COMPRESSION_NONE :
+            template_entry_compression(lookup, entry);
+        for(int i = slot->first_file; i != NO_FILE; i = table.next_file[i]) {
+            files[i].template_entry = entry;
+            files[i].compression = compression;
+        }
+    }
+
+    // NOTE(erick): The table is freed before the full paths are made, so
+    // the memory of the table can be reused when the allocator is an arena.
+    free_extension_table(&table);
+
+    // NOTE(erick): A single file has nothing to overlap with, and the
+    // templates of a pack are read with it. The descriptors are held until
+    // the templates are read, so only so many are prefetched.
+    bool prefetch = files_count > 1 && !lookup->pack.data;
+    int prefetched_count = 0;
+
+    for(int i = 0; i < files_count; i++) {
+        file_data* current_file = files + i;
+        if(current_file->failed) {
+            continue;
+        }
+
+        // NOTE(erick): A missing template only fails its own file. The
+        // others are still generated.
+        if(current_file->template_entry == NO_TEMPLATE) {
+            set_file_error(current_file, TEMPLATE_NO_TEMPLATE);
+            continue;
+        }
+
+        // NOTE(erick): The full path is made the first time a template is
+        // used, which is when it is prefetched.
+        bool first_use = !lookup->template_full_paths[current_file->template_entry];
+        current_file->template_file_path = get_template_full_path(lookup,
+                                                                  current_file->template_entry);
+        if(!current_file->template_file_path) {
+            set_file_error(current_file, TEMPLATE_NO_MEMORY);
+        } else if(prefetch && first_use && prefetched_count < TEMPLATE_PREFETCH_MAX_FDS) {
+            current_file->template_fd = prefetch_template(current_file->template_file_path);
+            prefetched_count += (current_file->template_fd >= 0);
+        }
+    }
+}
+
+void compile_templates(file_data* files, int files_count,
+                       template_lookup* lookup, bool include_plain_copies) {
+    // NOTE(erick): Plain copies normally go through the copy engine and
+    // don't need the template in memory. The templates of a pack are
+    // already in memory and are not files we could copy from, neither are
+    // compressed templates.
+    bool is_packed = lookup->pack.data != NULL;
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* current_file = files + file_index;
+        if(current_file->failed ||
+           (current_file->replace == DONT_REPLACE && !include_plain_copies &&
+            !is_packed && !current_file->update &&
+            current_file->compression == COMPRESSION_NONE)) {
+            continue;
+        }
+
+        int entry = current_file->template_entry;
+        if(!lookup->compile_attempted[entry]) {
+            lookup->compile_attempted[entry] = TRUE;
+
+            // NOTE(erick): Running out of memory here is not an error, the
+            // template is streamed from the disk instead.
+            compiled_template* compiled = (compiled_template*) allocate_memory(
+                lookup->allocator, sizeof(compiled_template));
+
+            bool compiled_ok = compiled && (is_packed ?
+                get_packed_template(&lookup->pack, entry, STUB_STR, compiled) :
+                compile_template(current_file->template_file_path,
+                                 current_file->template_fd, STUB_STR,
+                                 current_file->compression, compiled, lookup->allocator));
+            if(compiled && !is_packed) {
+                current_file->template_fd = -1;
+            }
+            if(compiled_ok) {
+                lookup->compiled_templates[entry] = compiled;
+            } else {
+                release_memory(lookup->allocator, compiled, sizeof(compiled_template));
+            }
+        }
+
+        current_file->compiled_template = lookup->compiled_templates[entry];
+    }
+}
+
+void set_file_error(file_data* file, template_error error) {
+    file->error = error;
+    file->failed = template_error_is_failure(error);
+}
+
+// NOTE(erick): Opens the template and takes its mode from the open fd
+// instead of looking the path up again.
+static int open_template_file(file_data* file, mode_t* mode) {
+    int template_fd = file->template_fd;
+    file->template_fd = -1;
+    if(template_fd < 0) {
+        STATS_SYSCALL(SYSCALL_OPEN);
+        template_fd = open(file->template_file_path, O_RDONLY | O_CLOEXEC);
+    }
+    if(template_fd < 0) {
+        set_file_error(file, TEMPLATE_OPEN_TEMPLATE_FAILED);
+        return -1;
+    }
+
+    stat_buf stat_buffer;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(fstat(template_fd, &stat_buffer)) {
+        set_file_error(file, TEMPLATE_TEMPLATE_MODE_FAILED);
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(template_fd);
+        return -1;
+    }
+
+    *mode = stat_buffer.st_mode;
+#if DEBUG
+    printf("Mode of %s is %o\n", file->template_file_path, *mode);
+#endif
+    return template_fd;
+}
+
+// NOTE(erick): Copies the open template into the output. Closes
+// template_fd.
+static copy_strategy copy_template_fd(file_data* file, int template_fd, mode_t mode) {
+    output_file output;
+    template_error error = open_output_file(file->file_path, mode,
+                                            file->can_override, &output);
+    if(error != TEMPLATE_OK) {
+        set_file_error(file, error);
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(template_fd);
+        return COPY_STRATEGY_FAILED;
+    }
+    output.start_writeback = (file->durability == DURABILITY_FILE);
+    output.keep_fd = output.start_writeback ? &file->output_fd : NULL;
+
+    copy_strategy strategy = copy_fd_contents(template_fd, output.fd);
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(template_fd);
+
+    error = close_output_file(&output, file->file_path,
+                              strategy != COPY_STRATEGY_FAILED);
+    if(error != TEMPLATE_OK) {
+        set_file_error(file, error);
+    }
+    if(template_error_is_failure(error)) {
+        strategy = COPY_STRATEGY_FAILED;
+    }
+
+    return strategy;
+}
+
+// NOTE(erick): Writes the output from the compiled template or, without
+// one, streams template_fd through the stub replacer and closes it.
+static bool replace_template_fd(file_data* file, compiled_template* compiled,
+                                int template_fd, mode_t mode, placeholder_values* values) {
+    output_file output;
+    template_error error = open_output_file(file->file_path, mode,
+                                            file->can_override, &output);
+    if(error != TEMPLATE_OK) {
+        set_file_error(file, error);
+        if(template_fd >= 0) {
+            STATS_SYSCALL(SYSCALL_CLOSE);
+            close(template_fd);
+        }
+        return !template_error_is_failure(error);
+    }
+    output.start_writeback = (file->durability == DURABILITY_FILE);
+    output.keep_fd = output.start_writeback ? &file->output_fd : NULL;
+
+    bool written;
+    if(compiled) {
+        written = write_compiled_template(compiled, output.fd, values);
+    } else {
+        written = replace_stubs_fd(template_fd, output.fd, values);
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(template_fd);
+    }
+
+    error = close_output_file(&output, file->file_path, written);
+    if(error != TEMPLATE_OK) {
+        set_file_error(file, error);
+    }
+
+    return !template_error_is_failure(error);
+}
+
+copy_strategy copy_without_replacement(file_data* file) {
+    mode_t mode;
+    int template_fd = open_template_file(file, &mode);
+    if(template_fd < 0) {
+        return COPY_STRATEGY_FAILED;
+    }
+
+    return copy_template_fd(file, template_fd, mode);
+}
+
+// NOTE(erick): Also used for plain copies of templates kept in memory, in
+// which case values is NULL.
+static bool copy_with_replacement(file_data* file, placeholder_values* values) {
+    if(file->compiled_template) {
+        return replace_template_fd(file, file->compiled_template, -1,
+                                   file->compiled_template->mode, values);
+    }
+
+    // NOTE(erick): The template could not be mapped (e.g. it is not a
+    // regular file), so we stream it instead.
+    mode_t mode;
+    int template_fd = open_template_file(file, &mode);
+    if(template_fd < 0) {
+        return FALSE;
+    }
+
+    return replace_template_fd(file, NULL, template_fd, mode, values);
+}
+
+// NOTE(erick): The values are worked out once per output. Files copied as
+// they are don't have any and get NULL. The file keeps its replace_string,
+// so the same file_data can be generated again.
+placeholder_values* get_placeholder_values(file_data* file, placeholder_values* values) {
+    if(file->replace == DONT_REPLACE) {
+        return NULL;
+    }
+
+    char* stub_value = (file->replace == REPLACE_WITH_ARGUMENT) ? file->replace_string : NULL;
+    make_placeholder_values(file->placeholders, STUB_STR, file->filename, stub_value, values);
+    return values;
+}
+
+// NOTE(erick): With update an output that is already what we would write
+// is left alone, so its mtime doesn't trigger rebuilds. It needs the
+// compiled template, without one the output is just written again.
+bool output_is_unchanged(file_data* file, placeholder_values* values) {
+    if(!file->update || !file->compiled_template) {
+        return FALSE;
+    }
+
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int output_fd = open(file->file_path, O_RDONLY | O_CLOEXEC);
+    if(output_fd < 0) {
+        return FALSE;
+    }
+
+    bool unchanged = compiled_template_matches(file->compiled_template, values, output_fd);
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(output_fd);
+
+    if(unchanged) {
+        set_file_error(file, TEMPLATE_UNCHANGED);
+    }
+    return unchanged;
+}
+
+// NOTE(erick): The output is opened with O_EXCL (or as a temporary file
+// with -o) and gets the mode of the already open template, see
+// output_file.c. There is no check before the open for others to race.
+static bool copy_file_from_template(file_data* file) {
+    // NOTE(erick): The file already failed before we got here (e.g. there
+    // is no template for it).
+    if(file->failed) {
+        return FALSE;
+    }
+
+    placeholder_values values_buffer;
+    placeholder_values* values = get_placeholder_values(file, &values_buffer);
+
+    if(file->compiled_template) {
+        if(!output_is_unchanged(file, values)) {
+            copy_with_replacement(file, values);
+        }
+        return !file->failed;
+    }
+
+    // NOTE(erick): A compressed template that couldn't be decompressed.
+    if(file->compression != COMPRESSION_NONE) {
+        set_file_error(file, TEMPLATE_OPEN_TEMPLATE_FAILED);
+        return FALSE;
+    }
+
+    mode_t mode;
+    int template_fd = open_template_file(file, &mode);
+    if(template_fd < 0) {
+        return FALSE;
+    }
+
+    if(S_ISDIR(mode)) {
+        // NOTE(erick): A scaffold, the whole directory is generated.
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(template_fd);
+        file->is_scaffold = TRUE;
+        set_file_error(file, generate_scaffold(file->template_file_path, file->file_path,
+                                               values, file->can_override, file->update));
+    } else if(file->replace == DONT_REPLACE) {
+#if DEBUG
+        copy_strategy strategy = copy_template_fd(file, template_fd, mode);
+        printf("Copied %s using %s\n", file->file_path, copy_strategy_name(strategy));
+#else
+        copy_template_fd(file, template_fd, mode);
+#endif
+    } else {
+        replace_template_fd(file, NULL, template_fd, mode, values);
+    }
+
+    return !file->failed;
+}
+
+bool copy_file(file_data* file) {
+    STATS_TIMER(file_timer);
+    bool result = copy_file_from_template(file);
+    STATS_FILE(file_timer);
+
+    return result;
+}
+
+inline bool is_absolute_path(char* path) {
+    if(path == NULL) {
+         return FALSE;
+    }
+
+    // NOTE(erick): We only support Unix-like paths i.e. paths starting with '/'
+    return path[0] == '/';
+}
+
+int template_error_is_failure(template_error error) {
+    return error >= TEMPLATE_NO_MEMORY;
+}
+
+char* template_error_string(template_error error) {
+    switch(error) {
+    case TEMPLATE_OK :                   return "No error";
+    case TEMPLATE_FILE_EXISTS :          return "The output file already exists";
+    case TEMPLATE_MODE_NOT_SET :         return "Could not set the mode of the output file";
+    case TEMPLATE_UNCHANGED :            return "The output file is up to date";
+    case TEMPLATE_NO_MEMORY :            return "Could not allocate memory";
+    case TEMPLATE_INVALID_ARGUMENT :     return "Invalid argument";
+    case TEMPLATE_NO_TEMPLATE_DIR :      return "Could not open the template directory";
+    case TEMPLATE_NO_EXTENSION :         return "The output file has no extension";
+    case TEMPLATE_NO_TEMPLATE :          return "Could not find a matching template";
+    case TEMPLATE_OPEN_TEMPLATE_FAILED : return "Could not open the template";
+    case TEMPLATE_OPEN_OUTPUT_FAILED :   return "Could not open the output file";
+    case TEMPLATE_WRITE_FAILED :         return "Failed to write the output file";
+    case TEMPLATE_TEMPLATE_MODE_FAILED : return "Could not get the mode of the template";
+    case TEMPLATE_PATH_TOO_LONG :        return "A path is longer than PATH_MAX";
+    }
+
+    return "Unknown error";
+}
+
+template_error template_context_create(char* template_dir_name,
+                                       template_allocator* allocator,
+                                       template_context** result) {
+    if(!result) {
+        return TEMPLATE_INVALID_ARGUMENT;
+    }
+    *result = NULL;
+
+    if(!allocator) {
+        allocator = default_allocator();
+    }
+
+    template_context* context = (template_context*) allocate_memory(
+        allocator, sizeof(template_context));
+    if(!context) {
+        return TEMPLATE_NO_MEMORY;
+    }
+
+    // NOTE(erick): The lookup points to the copy, the caller's allocator
+    // doesn't have to outlive the call.
+    context->allocator = *allocator;
+    placeholder_set_init(&context->placeholders, STUB_STR);
+
+    // NOTE(erick): Without a directory we look for it like the command line
+    // tool does, $TEMPLATE_DIR included.
+    if(!get_template_dir(context->template_dir_name, template_dir_name)) {
+        release_memory(allocator, context, sizeof(template_context));
+        return TEMPLATE_NO_TEMPLATE_DIR;
+    }
+
+    template_error error = init_template_lookup(&context->lookup,
+                                                context->template_dir_name,
+                                                FALSE, &context->allocator);
+    if(error != TEMPLATE_OK) {
+        release_memory(allocator, context, sizeof(template_context));
+        return error;
+    }
+
+    *result = context;
+    return TEMPLATE_OK;
+}
+
+template_error template_context_refresh(template_context* context) {
+    if(!context) {
+        return TEMPLATE_INVALID_ARGUMENT;
+    }
+
+    // NOTE(erick): The index cache makes this cheap when the directory
+    // didn't change. The old lookup is kept if the new one can't be built.
+    template_lookup new_lookup;
+    template_error error = init_template_lookup(&new_lookup, context->template_dir_name,
+                                                FALSE, &context->allocator);
+    if(error != TEMPLATE_OK) {
+        return error;
+    }
+
+    free_template_lookup(&context->lookup);
+    context->lookup = new_lookup;
+    return TEMPLATE_OK;
+}
+
+void template_context_destroy(template_context* context) {
+    if(!context) {
+        return;
+    }
+
+    template_allocator allocator = context->allocator;
+    free_template_lookup(&context->lookup);
+    release_memory(&allocator, context, sizeof(template_context));
+}
+
+char* template_context_dir(template_context* context) {
+    return context->template_dir_name;
+}
+
+// NOTE(erick): definition is "KEY=VALUE" and must outlive the context.
+template_error template_context_define(template_context* context, char* definition) {
+    if(!context || !definition || !define_placeholder(&context->placeholders, definition)) {
+        return TEMPLATE_INVALID_ARGUMENT;
+    }
+    return TEMPLATE_OK;
+}
+
+template_error template_generate(template_context* context, template_request* request) {
+    if(!context || !request || !request->output_path || !*request->output_path ||
+       (request->replace == REPLACE_WITH_ARGUMENT && !request->replace_string)) {
+        return TEMPLATE_INVALID_ARGUMENT;
+    }
+
+    template_lookup* lookup = &context->lookup;
+    file_data file;
+    memset(&file, 0, sizeof(file_data));
+    file.template_fd = -1;
+    file.output_fd = -1;
+    file.can_override = request->can_override || request->update;
+    file.update = request->update;
+    file.replace = request->replace;
+    file.replace_string = request->replace_string;
+    file.placeholders = &context->placeholders;
+    file.file_path = request->output_path;
+    file.file_extension = request->extension;
+
+    get_files_names(&file, 1);
+    get_files_extensions(&file, 1);
+
+    // NOTE(erick): A single file doesn't need the extension table, the
+    // trie is asked directly.
+    if(!file.failed) {
+        file.template_entry = suffix_trie_find_template(&lookup->trie, file.file_extension);
+        if(file.template_entry == NO_TEMPLATE) {
+            set_file_error(&file, TEMPLATE_NO_TEMPLATE);
+        } else {
+            file.compression = template_entry_compression(lookup, file.template_entry);
+            file.template_file_path = get_template_full_path(lookup, file.template_entry);
+            if(!file.template_file_path) {
+                set_file_error(&file, TEMPLATE_NO_MEMORY);
+            }
+        }
+    }
+
+    // NOTE(erick): Callers generate many files from the same few templates,
+    // so every template used is kept in memory, plain copies included.
+    compile_templates(&file, 1, lookup, TRUE);
+    copy_file(&file);
+
+    return file.error;
+}
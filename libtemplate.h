@@ -0,0 +1,65 @@
+#ifndef LIBTEMPLATE_H
+#define LIBTEMPLATE_H 1
+
+#include "allocator.h"
+
+// NOTE(erick): Errors below TEMPLATE_NO_MEMORY are warnings: the call
+// did all it could and the output is either there or was left untouched.
+typedef enum {
+    TEMPLATE_OK,
+    TEMPLATE_FILE_EXISTS,
+    TEMPLATE_MODE_NOT_SET,
+    TEMPLATE_UNCHANGED,
+
+    TEMPLATE_NO_MEMORY,
+    TEMPLATE_INVALID_ARGUMENT,
+    TEMPLATE_NO_TEMPLATE_DIR,
+    TEMPLATE_NO_EXTENSION,
+    TEMPLATE_NO_TEMPLATE,
+    TEMPLATE_OPEN_TEMPLATE_FAILED,
+    TEMPLATE_OPEN_OUTPUT_FAILED,
+    TEMPLATE_WRITE_FAILED,
+    TEMPLATE_TEMPLATE_MODE_FAILED,
+    TEMPLATE_PATH_TOO_LONG
+} template_error;
+
+typedef enum {
+    DONT_REPLACE,
+    REPLACE_WITH_NAME,
+    REPLACE_WITH_ARGUMENT
+} replace_mode;
+
+// NOTE(erick): The library version of a file on the command line.
+// output_path is absolute or relative to the working directory, a bare
+// name like "a.h" included. extension may be NULL, in which case it is
+// taken from the output file name. replace_string is only used with REPLACE_WITH_ARGUMENT. In both
+// replace modes the placeholders ("???NAME???" and the ones defined with
+// template_context_define) are replaced too. update
+// overrides the output only if its contents would change, otherwise the
+// result is TEMPLATE_UNCHANGED.
+typedef struct {
+    char* output_path;
+    char* extension;
+    replace_mode replace;
+    char* replace_string;
+    int can_override;
+    int update;
+} template_request;
+
+// NOTE(erick): A context holds the template lookup of a template
+// directory and the templates already loaded from it. Contexts don't
+// share anything, but a single context must not be used by two threads
+// at the same time.
+typedef struct template_context template_context;
+
+TEMPLATE_API template_error template_context_create(char*, template_allocator*,
+                                                    template_context**);
+TEMPLATE_API template_error template_generate(template_context*, template_request*);
+TEMPLATE_API template_error template_context_refresh(template_context*);
+TEMPLATE_API void template_context_destroy(template_context*);
+TEMPLATE_API char* template_context_dir(template_context*);
+TEMPLATE_API template_error template_context_define(template_context*, char*);
+TEMPLATE_API char* template_error_string(template_error);
+TEMPLATE_API int template_error_is_failure(template_error);
+
+#endif
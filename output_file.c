@@ -0,0 +1,305 @@
+/* Creates the outputs with as few path lookups as possible and without
+ * races against other processes writing the same files.
+ *
+ * A new output is opened with O_CREAT | O_EXCL and the template mode, so
+ * there is no separate existence check and, unless the umask took some
+ * bits away, no chmod either.
+ *
+ * An output that may overwrite a file (-o) is written to an unnamed
+ * O_TMPFILE in the destination directory and linked to its name once it
+ * is complete. If the name is taken the file is linked under a temporary
+ * name and renamed over it. Either way the old contents are replaced at
+ * once, even with several builds generating the same file.
+ *
+ * File systems without O_TMPFILE get the old behavior: the output is
+ * truncated and written in place.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "output_file.h"
+#include "stats.h"
+
+#define OUTPUT_TEMPORARY_NAME_ATTEMPTS 16
+#define OUTPUT_MIN_KEPT_FDS 16
+
+static int kept_fds_count = 0;
+
+// NOTE(erick): Setting the umask to read it would change it for the
+// other threads for a moment, so it is read from /proc instead. If that
+// fails every bit counts as masked and the mode is always set.
+mode_t output_umask() {
+    static int cached_umask = -1;
+
+    int result = __atomic_load_n(&cached_umask, __ATOMIC_RELAXED);
+    if(result >= 0) {
+        return (mode_t) result;
+    }
+
+    result = 07777;
+    FILE* status = fopen("/proc/self/status", "r");
+    if(status) {
+        char line[256];
+        while(fgets(line, sizeof(line), status)) {
+            unsigned int value;
+            if(sscanf(line, "Umask: %o", &value) == 1) {
+                result = value & 07777;
+                break;
+            }
+        }
+        fclose(status);
+    }
+
+    __atomic_store_n(&cached_umask, result, __ATOMIC_RELAXED);
+    return (mode_t) result;
+}
+
+// NOTE(erick): The directory part of path, "." if it has none.
+bool output_directory(char* path, char* directory, size_t directory_size) {
+    char* last_slash = strrchr(path, '/');
+    if(!last_slash) {
+        return snprintf(directory, directory_size, ".") < (int) directory_size;
+    }
+
+    size_t length = last_slash - path;
+    if(length == 0) {
+        length = 1; // The root directory keeps its slash
+    }
+    if(length >= directory_size) {
+        return FALSE;
+    }
+
+    memcpy(directory, path, length);
+    directory[length] = '\0';
+    return TRUE;
+}
+
+template_error open_output_file(char* path, mode_t mode, bool can_override,
+                                output_file* output) {
+    output->mode = mode & 07777;
+    output->is_temporary = FALSE;
+    output->start_writeback = FALSE;
+    output->keep_fd = NULL;
+    output->needs_chmod = (output->mode & output_umask()) != 0;
+
+    if(can_override) {
+        char directory[PATH_MAX];
+        if(!output_directory(path, directory, sizeof(directory))) {
+            return TEMPLATE_OPEN_OUTPUT_FAILED;
+        }
+
+        STATS_SYSCALL(SYSCALL_OPEN);
+        output->fd = open(directory, O_TMPFILE | O_WRONLY | O_CLOEXEC, output->mode);
+        if(output->fd >= 0) {
+            output->is_temporary = TRUE;
+            return TEMPLATE_OK;
+        }
+        if(errno != EOPNOTSUPP && errno != EISDIR) {
+            return TEMPLATE_OPEN_OUTPUT_FAILED;
+        }
+
+        // NOTE(erick): An existing file keeps its mode with O_TRUNC.
+        output->needs_chmod = TRUE;
+        STATS_SYSCALL(SYSCALL_OPEN);
+        output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, output->mode);
+    } else {
+        STATS_SYSCALL(SYSCALL_OPEN);
+        output->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, output->mode);
+        if(output->fd < 0 && errno == EEXIST) {
+            return TEMPLATE_FILE_EXISTS;
+        }
+    }
+
+    return output->fd < 0 ? TEMPLATE_OPEN_OUTPUT_FAILED : TEMPLATE_OK;
+}
+
+// NOTE(erick): Links source_path to path, replacing whatever is there.
+// If the name is taken the link is made under a temporary name and renamed
+// over it, so path is never missing.
+static bool link_over(char* source_path, int link_flags, char* path) {
+    STATS_SYSCALL(SYSCALL_LINK);
+    if(linkat(AT_FDCWD, source_path, AT_FDCWD, path, link_flags) == 0) {
+        return TRUE;
+    }
+    if(errno != EEXIST) {
+        return FALSE;
+    }
+
+    char directory[PATH_MAX];
+    if(!output_directory(path, directory, sizeof(directory))) {
+        return FALSE;
+    }
+
+    static uint temporary_count = 0;
+    for(int attempt = 0; attempt < OUTPUT_TEMPORARY_NAME_ATTEMPTS; attempt++) {
+        char temporary_path[PATH_MAX];
+        uint temporary_index = __atomic_fetch_add(&temporary_count, 1, __ATOMIC_RELAXED);
+        int length = snprintf(temporary_path, sizeof(temporary_path), "%s/.template-%d-%u",
+                              directory, (int) getpid(), temporary_index);
+        if(length < 0 || length >= (int) sizeof(temporary_path)) {
+            return FALSE;
+        }
+
+        STATS_SYSCALL(SYSCALL_LINK);
+        if(linkat(AT_FDCWD, source_path, AT_FDCWD, temporary_path, link_flags) == 0) {
+            STATS_SYSCALL(SYSCALL_LINK);
+            if(rename(temporary_path, path) == 0) {
+                return TRUE;
+            }
+            unlink(temporary_path);
+            return FALSE;
+        }
+        if(errno != EEXIST) {
+            return FALSE;
+        }
+    }
+
+    return FALSE;
+}
+
+// NOTE(erick): linkat with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, going
+// through /proc doesn't.
+static bool link_temporary_file(int fd, char* path) {
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+    return link_over(fd_path, AT_SYMLINK_FOLLOW, path);
+}
+
+// NOTE(erick): Makes path another name of the finished output source_path.
+template_error link_output_file(char* source_path, char* path, bool can_override) {
+    if(can_override) {
+        // NOTE(erick): rename does nothing when both names are links to
+        // the same file, the temporary name would be left behind.
+        struct stat source_stat;
+        struct stat output_stat;
+        STATS_SYSCALL(SYSCALL_STAT);
+        STATS_SYSCALL(SYSCALL_STAT);
+        if(stat(source_path, &source_stat) == 0 && stat(path, &output_stat) == 0 &&
+           source_stat.st_dev == output_stat.st_dev && source_stat.st_ino == output_stat.st_ino) {
+            return TEMPLATE_OK;
+        }
+
+        return link_over(source_path, 0, path) ? TEMPLATE_OK : TEMPLATE_OPEN_OUTPUT_FAILED;
+    }
+
+    STATS_SYSCALL(SYSCALL_LINK);
+    if(link(source_path, path) == 0) {
+        return TEMPLATE_OK;
+    }
+    return errno == EEXIST ? TEMPLATE_FILE_EXISTS : TEMPLATE_OPEN_OUTPUT_FAILED;
+}
+
+// NOTE(erick): Sets the mode and, for temporary outputs, puts the file in
+// place. The fd stays open.
+template_error commit_output_file(output_file* output, char* path) {
+    template_error result = TEMPLATE_OK;
+
+    if(output->needs_chmod) {
+        STATS_SYSCALL(SYSCALL_CHMOD);
+        if(fchmod(output->fd, output->mode)) {
+            result = TEMPLATE_MODE_NOT_SET;
+        }
+    }
+
+    // NOTE(erick): Only starts the writeback, it is waited for once all
+    // the outputs are written (see durability.c).
+    if(output->start_writeback) {
+        STATS_SYSCALL(SYSCALL_SYNC);
+        sync_file_range(output->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+
+    if(output->is_temporary && !link_temporary_file(output->fd, path)) {
+        result = TEMPLATE_WRITE_FAILED;
+    }
+
+    return result;
+}
+
+// NOTE(erick): How many outputs may be kept open at once: half of the
+// descriptors, after raising the soft limit as far as it goes. Worked out
+// the first time an output is kept.
+static int kept_fds_limit() {
+    static int cached_limit = -1;
+
+    int result = __atomic_load_n(&cached_limit, __ATOMIC_RELAXED);
+    if(result >= 0) {
+        return result;
+    }
+
+    result = OUTPUT_MIN_KEPT_FDS;
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        if(limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            if(setrlimit(RLIMIT_NOFILE, &limit)) {
+                getrlimit(RLIMIT_NOFILE, &limit);
+            }
+        }
+        if(limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur / 2 < INT_MAX &&
+           (int) (limit.rlim_cur / 2) > result) {
+            result = (int) (limit.rlim_cur / 2);
+        }
+    }
+
+    __atomic_store_n(&cached_limit, result, __ATOMIC_RELAXED);
+    return result;
+}
+
+// NOTE(erick): Hands a committed output over to keep_fd, so it is synced
+// later through the fd it was written with instead of being opened again.
+// Past the limit of kept fds it is synced right away and stays with the
+// caller to be closed.
+template_error keep_output_file(output_file* output) {
+    int kept_count = __atomic_add_fetch(&kept_fds_count, 1, __ATOMIC_RELAXED);
+    if(kept_count <= kept_fds_limit()) {
+        *output->keep_fd = output->fd;
+        output->fd = -1;
+        return TEMPLATE_OK;
+    }
+    __atomic_sub_fetch(&kept_fds_count, 1, __ATOMIC_RELAXED);
+
+    STATS_SYSCALL(SYSCALL_SYNC);
+    return fsync(output->fd) ? TEMPLATE_WRITE_FAILED : TEMPLATE_OK;
+}
+
+void close_kept_output(int fd) {
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(fd);
+    __atomic_sub_fetch(&kept_fds_count, 1, __ATOMIC_RELAXED);
+}
+
+// NOTE(erick): A temporary output that was not written goes away with
+// its fd, the destination is never touched.
+template_error close_output_file(output_file* output, char* path, bool written) {
+    template_error result = TEMPLATE_WRITE_FAILED;
+    if(written) {
+        result = commit_output_file(output, path);
+    }
+
+    if(output->keep_fd && !template_error_is_failure(result)) {
+        template_error keep_result = keep_output_file(output);
+        if(keep_result != TEMPLATE_OK) {
+            result = keep_result;
+        }
+        if(output->fd < 0) {
+            return result;
+        }
+    }
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    if(close(output->fd) && !template_error_is_failure(result)) {
+        result = TEMPLATE_WRITE_FAILED;
+    }
+    output->fd = -1;
+
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H 1
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "default_definitions.h"
+#include "libtemplate.h"
+
+// NOTE(erick): An output being written. Outputs that may replace an
+// existing file are temporary (O_TMPFILE) until commit_output_file links
+// them in place, so nobody ever sees half of one. With start_writeback
+// the commit also starts writing it to the disk (--durability=file), and
+// with keep_fd the fd is handed over there instead of being closed.
+typedef struct {
+    int fd;
+    mode_t mode;
+    bool is_temporary;
+    bool needs_chmod;
+    bool start_writeback;
+    int* keep_fd;
+} output_file;
+
+mode_t output_umask();
+bool output_directory(char*, char*, size_t);
+template_error open_output_file(char*, mode_t, bool, output_file*);
+template_error commit_output_file(output_file*, char*);
+template_error keep_output_file(output_file*);
+void close_kept_output(int);
+template_error close_output_file(output_file*, char*, bool);
+template_error link_output_file(char*, char*, bool);
+
+#endif
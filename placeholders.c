@@ -0,0 +1,233 @@
+/* Named placeholders: "???KEY???" is replaced with the value of KEY.
+ *
+ * Every placeholder opens with the stub, so finding them costs nothing on
+ * top of finding the stubs: the same vectorized memchr skips the text
+ * between stubs, and only at a stub the bytes that follow are run through
+ * a trie of the keys. A placeholder is matched in a single walk however
+ * many keys there are, and a stub that doesn't open one is just a stub.
+ *
+ * NAME, GUARD and STEM are always there and derived from the output name
+ * ("http_client.h" gives HttpClient, HTTP_CLIENT_H and http_client).
+ * Other keys come from definitions (-D KEY=VALUE), which can also give
+ * the built in keys a fixed value.
+ *
+ * Keys are letters, digits and '_', so a key can never run into the
+ * closing stub.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <ctype.h>
+
+#include "placeholders.h"
+
+static char* builtin_keys[PLACEHOLDER_BUILTIN_COUNT] = {"NAME", "GUARD", "STEM"};
+
+static bool is_key_char(uint8 c) {
+    return isalnum(c) || c == '_';
+}
+
+static uint find_child(placeholder_set* set, uint node, uint8 byte) {
+    uint child = set->nodes[node].first_child;
+    while(child != PLACEHOLDER_NO_NODE && set->nodes[child].byte != byte) {
+        child = set->nodes[child].next_sibling;
+    }
+    return child;
+}
+
+// NOTE(erick): Returns the key, a new one if it wasn't there.
+static int insert_key(placeholder_set* set, char* key, size_t key_len) {
+    if(key_len == 0 || key_len > PLACEHOLDER_MAX_KEY_LEN) {
+        return PLACEHOLDER_NO_KEY;
+    }
+
+    uint node = 0;
+    for(size_t i = 0; i < key_len; i++) {
+        if(!is_key_char(key[i])) {
+            return PLACEHOLDER_NO_KEY;
+        }
+
+        uint child = find_child(set, node, key[i]);
+        if(child == PLACEHOLDER_NO_NODE) {
+            if(set->nodes_count == PLACEHOLDER_MAX_NODES) {
+                return PLACEHOLDER_NO_KEY;
+            }
+
+            child = set->nodes_count++;
+            set->nodes[child].byte = key[i];
+            set->nodes[child].key = PLACEHOLDER_NO_KEY;
+            set->nodes[child].first_child = PLACEHOLDER_NO_NODE;
+            set->nodes[child].next_sibling = set->nodes[node].first_child;
+            set->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+
+    if(set->nodes[node].key == PLACEHOLDER_NO_KEY) {
+        if(set->keys_count == PLACEHOLDER_MAX_KEYS) {
+            return PLACEHOLDER_NO_KEY;
+        }
+        set->nodes[node].key = set->keys_count++;
+        if(key_len > set->max_key_len) {
+            set->max_key_len = key_len;
+        }
+    }
+
+    return set->nodes[node].key;
+}
+
+void placeholder_set_init(placeholder_set* set, char* stub) {
+    memset(set, 0, sizeof(placeholder_set));
+    set->stub = stub;
+    set->stub_len = strlen(stub);
+    set->nodes_count = 1;
+    set->nodes[0].key = PLACEHOLDER_NO_KEY;
+
+    for(int key = 0; key < PLACEHOLDER_BUILTIN_COUNT; key++) {
+        insert_key(set, builtin_keys[key], strlen(builtin_keys[key]));
+    }
+}
+
+// NOTE(erick): definition is "KEY=VALUE". The value is not copied, it
+// must live as long as the set.
+bool define_placeholder(placeholder_set* set, char* definition) {
+    char* equals = strchr(definition, '=');
+    if(!equals) {
+        return FALSE;
+    }
+
+    int key = insert_key(set, definition, equals - definition);
+    if(key == PLACEHOLDER_NO_KEY) {
+        return FALSE;
+    }
+
+    set->defined_count += (set->defined_values[key] == NULL);
+    set->defined_values[key] = equals + 1;
+    return TRUE;
+}
+
+// NOTE(erick): text starts right after a stub. If it continues with a key
+// and a closing stub, returns the key and sets placeholder_len to the
+// length of both. Otherwise the stub is just a stub.
+int find_placeholder(placeholder_set* set, uint8* text, size_t text_len,
+                     size_t* placeholder_len) {
+    if(!set) {
+        return PLACEHOLDER_NO_KEY;
+    }
+
+    uint node = 0;
+    for(size_t i = 0; i < text_len; i++) {
+        int key = set->nodes[node].key;
+        if(key != PLACEHOLDER_NO_KEY && text_len - i >= set->stub_len &&
+           memcmp(text + i, set->stub, set->stub_len) == 0) {
+            *placeholder_len = i + set->stub_len;
+            return key;
+        }
+
+        node = find_child(set, node, text[i]);
+        if(node == PLACEHOLDER_NO_NODE) {
+            break;
+        }
+    }
+
+    return PLACEHOLDER_NO_KEY;
+}
+
+static void derive_values(char* filename, placeholder_values* values) {
+    char* guard = values->derived_values[PLACEHOLDER_GUARD];
+    char* stem = values->derived_values[PLACEHOLDER_STEM];
+    char* name = values->derived_values[PLACEHOLDER_NAME];
+
+    size_t filename_len = strnlen(filename, NAME_MAX);
+    char* last_dot = memrchr(filename, '.', filename_len);
+    size_t stem_len = (last_dot && last_dot != filename) ?
+        (size_t) (last_dot - filename) : filename_len;
+
+    for(size_t i = 0; i < filename_len; i++) {
+        guard[i] = isalnum((uint8) filename[i]) ? toupper((uint8) filename[i]) : '_';
+    }
+    guard[filename_len] = '\0';
+
+    memcpy(stem, filename, stem_len);
+    stem[stem_len] = '\0';
+
+    // NOTE(erick): The words of the stem, capitalized and put together.
+    size_t name_len = 0;
+    bool starts_word = TRUE;
+    for(size_t i = 0; i < stem_len; i++) {
+        if(!isalnum((uint8) stem[i])) {
+            starts_word = TRUE;
+            continue;
+        }
+        name[name_len++] = starts_word ? toupper((uint8) stem[i]) : stem[i];
+        starts_word = FALSE;
+    }
+    name[name_len] = '\0';
+}
+
+// NOTE(erick): Without a stub_value the stub is replaced with the GUARD
+// form of the name, like it always was with -r.
+void make_placeholder_values(placeholder_set* set, char* stub, char* filename,
+                             char* stub_value, placeholder_values* values) {
+    derive_values(filename, values);
+
+    values->set = set;
+    values->stub = stub;
+    values->stub_len = strlen(stub);
+    values->stub_value = stub_value ? stub_value : values->derived_values[PLACEHOLDER_GUARD];
+    values->stub_value_len = strlen(values->stub_value);
+
+    for(uint key = 0; set && key < set->keys_count; key++) {
+        char* value = set->defined_values[key];
+        if(!value) {
+            value = values->derived_values[key];
+        }
+        values->values[key] = value;
+        values->value_lens[key] = strlen(value);
+    }
+}
+
+// NOTE(erick): For short strings, like file names. Fails if the result
+// doesn't fit.
+bool replace_placeholders(placeholder_values* values, char* text,
+                          char* result, size_t result_size) {
+    char* text_end = text + strlen(text);
+    size_t result_len = 0;
+
+    while(text < text_end) {
+        char* stub = strstr(text, values->stub);
+        size_t literal_len = stub ? (size_t) (stub - text) : (size_t) (text_end - text);
+        if(result_len + literal_len >= result_size) {
+            return FALSE;
+        }
+
+        memcpy(result + result_len, text, literal_len);
+        result_len += literal_len;
+        text += literal_len;
+        if(!stub) {
+            break;
+        }
+        text += values->stub_len;
+
+        size_t placeholder_len = 0;
+        int key = find_placeholder(values->set, (uint8*) text, text_end - text,
+                                   &placeholder_len);
+        char* value = values->stub_value;
+        size_t value_len = values->stub_value_len;
+        if(key != PLACEHOLDER_NO_KEY) {
+            value = values->values[key];
+            value_len = values->value_lens[key];
+            text += placeholder_len;
+        }
+
+        if(result_len + value_len >= result_size) {
+            return FALSE;
+        }
+        memcpy(result + result_len, value, value_len);
+        result_len += value_len;
+    }
+    result[result_len] = '\0';
+
+    return TRUE;
+}
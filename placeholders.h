@@ -0,0 +1,64 @@
+#ifndef PLACEHOLDERS_H
+#define PLACEHOLDERS_H 1
+
+#include <stddef.h>
+#include <limits.h>
+#include "default_definitions.h"
+
+#define PLACEHOLDER_MAX_KEYS 32
+#define PLACEHOLDER_MAX_KEY_LEN 64
+#define PLACEHOLDER_MAX_NODES 1024
+#define PLACEHOLDER_NO_KEY (-1)
+#define PLACEHOLDER_NO_NODE 0
+
+// NOTE(erick): The keys every set has. Their values are derived from the
+// output name unless they are defined.
+typedef enum {
+    PLACEHOLDER_NAME,
+    PLACEHOLDER_GUARD,
+    PLACEHOLDER_STEM,
+    PLACEHOLDER_BUILTIN_COUNT
+} placeholder_builtin;
+
+// NOTE(erick): A node of the key trie. Keys are few and short, so the
+// children are a list of siblings. The root is node 0, which is nobody's
+// child, so 0 also marks the end of a list.
+typedef struct {
+    uint16 first_child;
+    uint16 next_sibling;
+    int8 key;
+    uint8 byte;
+} placeholder_node;
+
+typedef struct {
+    char* stub;
+    size_t stub_len;
+    placeholder_node nodes[PLACEHOLDER_MAX_NODES];
+    uint nodes_count;
+    char* defined_values[PLACEHOLDER_MAX_KEYS];
+    uint keys_count;
+    uint defined_count;
+    size_t max_key_len;
+} placeholder_set;
+
+// NOTE(erick): The values of an output, worked out once before it is
+// written. stub_value replaces a stub that doesn't open a placeholder.
+// set may be NULL, then only the stub is replaced.
+typedef struct {
+    placeholder_set* set;
+    char* stub;
+    size_t stub_len;
+    char* stub_value;
+    size_t stub_value_len;
+    char* values[PLACEHOLDER_MAX_KEYS];
+    size_t value_lens[PLACEHOLDER_MAX_KEYS];
+    char derived_values[PLACEHOLDER_BUILTIN_COUNT][NAME_MAX + 1];
+} placeholder_values;
+
+void placeholder_set_init(placeholder_set*, char*);
+bool define_placeholder(placeholder_set*, char*);
+int find_placeholder(placeholder_set*, uint8*, size_t, size_t*);
+void make_placeholder_values(placeholder_set*, char*, char*, char*, placeholder_values*);
+bool replace_placeholders(placeholder_values*, char*, char*, size_t);
+
+#endif
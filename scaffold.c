@@ -0,0 +1,397 @@
+/* Scaffolds: templates that are whole directories.
+ *
+ * The template tree is walked once by the calling thread. The directories
+ * are created as they are found (they must exist before anything can be
+ * written into them) and the regular files are only listed. The files are
+ * then generated by a pool of workers, each one with the cheapest copy the
+ * kernel offers or through the stub replacer.
+ *
+ * The stub and the placeholders are replaced in the names of files and
+ * directories too, so "???/???STEM???.h" can become "PARSER/parser.h".
+ * Symbolic links are copied as they are. Other kinds of files are skipped.
+ *
+ * Directories are created writable by us and get their real mode once all
+ * the files are in, so read-only directories in a template work too.
+ *
+ * With update (--update) files and links that are already what we would
+ * write are left alone, like single outputs, so a scaffold generated again
+ * only touches what changed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "scaffold.h"
+#include "arena.h"
+#include "copy_engine.h"
+#include "stub_replacer.h"
+#include "output_file.h"
+#include "compiled_template.h"
+#include "worker_pool.h"
+#include "stats.h"
+
+typedef struct {
+    char* template_path;
+    char* output_path;
+    mode_t mode;
+    bool is_directory;
+    bool needs_chmod;
+    template_error error;
+} scaffold_entry;
+
+typedef struct {
+    template_allocator allocator;
+    scaffold_entry* entries;
+    int entries_count;
+    int entries_capacity;
+    int files_count;
+    placeholder_values* values;
+    bool can_override;
+    bool update;
+    mode_t process_umask;
+} scaffold;
+
+// NOTE(erick): A tree deeper than PATH_MAX can't be generated, that is
+// reported on its own instead of as running out of memory.
+static template_error scaffold_path(scaffold* tree, char* directory, char* name,
+                                    char** path) {
+    size_t directory_len = strlen(directory);
+    size_t name_len = strlen(name);
+    if(directory_len + name_len + 2 > PATH_MAX) {
+        return TEMPLATE_PATH_TOO_LONG;
+    }
+
+    *path = allocate_string(&tree->allocator, directory_len + name_len + 1);
+    if(!*path) {
+        return TEMPLATE_NO_MEMORY;
+    }
+
+    memcpy(*path, directory, directory_len);
+    (*path)[directory_len] = '/';
+    memcpy(*path + directory_len + 1, name, name_len + 1);
+    return TEMPLATE_OK;
+}
+
+// NOTE(erick): The replaced name still has to be a single path component.
+static bool scaffold_name(scaffold* tree, char* name, char* result, size_t result_size) {
+    if(!tree->values) {
+        size_t name_len = strlen(name);
+        if(name_len >= result_size) {
+            return FALSE;
+        }
+        memcpy(result, name, name_len + 1);
+        return TRUE;
+    }
+
+    return replace_placeholders(tree->values, name, result, result_size) &&
+        *result && !strchr(result, '/') &&
+        strcmp(result, ".") != 0 && strcmp(result, "..") != 0;
+}
+
+static scaffold_entry* add_scaffold_entry(scaffold* tree, char* template_path,
+                                          char* output_path) {
+    if(tree->entries_count == tree->entries_capacity) {
+        int new_capacity = tree->entries_capacity ? tree->entries_capacity * 2 : 64;
+        scaffold_entry* new_entries = (scaffold_entry*) reallocate_memory(
+            &tree->allocator, tree->entries,
+            tree->entries_capacity * sizeof(scaffold_entry),
+            new_capacity * sizeof(scaffold_entry));
+        if(!new_entries) {
+            return NULL;
+        }
+        tree->entries = new_entries;
+        tree->entries_capacity = new_capacity;
+    }
+
+    scaffold_entry* entry = tree->entries + tree->entries_count++;
+    memset(entry, 0, sizeof(scaffold_entry));
+    entry->template_path = template_path;
+    entry->output_path = output_path;
+    return entry;
+}
+
+static template_error make_scaffold_directory(scaffold* tree, char* template_path,
+                                              char* output_path, mode_t mode) {
+    mode &= 07777;
+    bool existed = FALSE;
+
+    STATS_SYSCALL(SYSCALL_MKDIR);
+    if(mkdir(output_path, mode | S_IRWXU)) {
+        if(errno != EEXIST) {
+            return TEMPLATE_OPEN_OUTPUT_FAILED;
+        }
+        if(!tree->can_override) {
+            return TEMPLATE_FILE_EXISTS;
+        }
+
+        struct stat output_stat;
+        STATS_SYSCALL(SYSCALL_STAT);
+        if(stat(output_path, &output_stat) || !S_ISDIR(output_stat.st_mode)) {
+            return TEMPLATE_OPEN_OUTPUT_FAILED;
+        }
+        existed = TRUE;
+    }
+
+    scaffold_entry* entry = add_scaffold_entry(tree, template_path, output_path);
+    if(!entry) {
+        return TEMPLATE_NO_MEMORY;
+    }
+    entry->is_directory = TRUE;
+    entry->mode = mode;
+    entry->needs_chmod = existed || ((mode | S_IRWXU) & ~tree->process_umask) != mode;
+
+    return TEMPLATE_OK;
+}
+
+static template_error copy_scaffold_link(scaffold* tree, char* template_path,
+                                         char* output_path) {
+    char target[PATH_MAX];
+    ssize_t target_len = readlink(template_path, target, sizeof(target) - 1);
+    if(target_len < 0) {
+        return TEMPLATE_OPEN_TEMPLATE_FAILED;
+    }
+    target[target_len] = '\0';
+
+    STATS_SYSCALL(SYSCALL_LINK);
+    if(symlink(target, output_path) == 0) {
+        return TEMPLATE_OK;
+    }
+    if(errno != EEXIST) {
+        return TEMPLATE_OPEN_OUTPUT_FAILED;
+    }
+    if(!tree->can_override) {
+        return TEMPLATE_FILE_EXISTS;
+    }
+
+    if(tree->update) {
+        char output_target[PATH_MAX];
+        ssize_t output_target_len = readlink(output_path, output_target,
+                                             sizeof(output_target) - 1);
+        if(output_target_len == target_len && memcmp(output_target, target, target_len) == 0) {
+            return TEMPLATE_OK;
+        }
+    }
+
+    STATS_SYSCALL(SYSCALL_LINK);
+    if(unlink(output_path) || symlink(target, output_path)) {
+        return TEMPLATE_OPEN_OUTPUT_FAILED;
+    }
+    return TEMPLATE_OK;
+}
+
+static template_error walk_scaffold(scaffold* tree, char* template_dir, char* output_dir) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    DIR* directory = opendir(template_dir);
+    if(!directory) {
+        return TEMPLATE_OPEN_TEMPLATE_FAILED;
+    }
+
+    template_error result = TEMPLATE_OK;
+    struct dirent* dir_entry;
+    while(!template_error_is_failure(result) && (dir_entry = readdir(directory))) {
+        STATS_SYSCALL(SYSCALL_READDIR);
+        char* name = dir_entry->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        char output_name[NAME_MAX + 1];
+        if(!scaffold_name(tree, name, output_name, sizeof(output_name))) {
+            result = TEMPLATE_OPEN_OUTPUT_FAILED;
+            break;
+        }
+
+        char* template_path;
+        char* output_path;
+        template_error path_error = scaffold_path(tree, template_dir, name, &template_path);
+        if(path_error == TEMPLATE_OK) {
+            path_error = scaffold_path(tree, output_dir, output_name, &output_path);
+        }
+        if(path_error != TEMPLATE_OK) {
+            result = path_error;
+            break;
+        }
+
+        // NOTE(erick): Regular files get their mode from the open template
+        // in the workers, everything else needs a stat here.
+        mode_t mode = DTTOIF(dir_entry->d_type);
+        if(dir_entry->d_type == DT_DIR || dir_entry->d_type == DT_UNKNOWN) {
+            struct stat template_stat;
+            STATS_SYSCALL(SYSCALL_STAT);
+            if(fstatat(dirfd(directory), name, &template_stat, AT_SYMLINK_NOFOLLOW)) {
+                result = TEMPLATE_OPEN_TEMPLATE_FAILED;
+                break;
+            }
+            mode = template_stat.st_mode;
+        }
+
+        template_error error = TEMPLATE_OK;
+        if(S_ISDIR(mode)) {
+            error = make_scaffold_directory(tree, template_path, output_path, mode);
+            if(error == TEMPLATE_OK) {
+                error = walk_scaffold(tree, template_path, output_path);
+            }
+        } else if(S_ISREG(mode)) {
+            if(add_scaffold_entry(tree, template_path, output_path)) {
+                tree->files_count++;
+            } else {
+                error = TEMPLATE_NO_MEMORY;
+            }
+        } else if(S_ISLNK(mode)) {
+            error = copy_scaffold_link(tree, template_path, output_path);
+        }
+
+        if(error > result) {
+            result = error;
+        }
+    }
+
+    closedir(directory);
+    return result;
+}
+
+// NOTE(erick): With update the template is compiled so the existing
+// output can be compared against what would be written, which is then
+// written from the compiled template. Closes template_fd.
+static void update_scaffold_file(scaffold* tree, scaffold_entry* entry, int template_fd) {
+    compiled_template compiled;
+    char* stub = tree->values ? tree->values->stub : "";
+    if(!compile_template(entry->template_path, template_fd, stub, COMPRESSION_NONE,
+                         &compiled, default_allocator())) {
+        entry->error = TEMPLATE_OPEN_TEMPLATE_FAILED;
+        return;
+    }
+
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int output_fd = open(entry->output_path, O_RDONLY | O_CLOEXEC);
+    if(output_fd >= 0) {
+        bool unchanged = compiled_template_matches(&compiled, tree->values, output_fd);
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(output_fd);
+        if(unchanged) {
+            free_compiled_template(&compiled);
+            return;
+        }
+    }
+
+    output_file output;
+    entry->error = open_output_file(entry->output_path, compiled.mode, TRUE, &output);
+    if(entry->error == TEMPLATE_OK) {
+        bool written = write_compiled_template(&compiled, output.fd, tree->values);
+        entry->error = close_output_file(&output, entry->output_path, written);
+    }
+
+    free_compiled_template(&compiled);
+}
+
+static void generate_scaffold_file(void* context, int entry_index) {
+    scaffold* tree = (scaffold*) context;
+    scaffold_entry* entry = tree->entries + entry_index;
+    if(entry->is_directory) {
+        return;
+    }
+
+    STATS_TIMER(file_timer);
+
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int template_fd = open(entry->template_path, O_RDONLY | O_CLOEXEC);
+    if(template_fd < 0) {
+        entry->error = TEMPLATE_OPEN_TEMPLATE_FAILED;
+        return;
+    }
+
+    if(tree->update) {
+        update_scaffold_file(tree, entry, template_fd);
+        STATS_FILE(file_timer);
+        return;
+    }
+
+    struct stat template_stat;
+    output_file output;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(fstat(template_fd, &template_stat)) {
+        entry->error = TEMPLATE_TEMPLATE_MODE_FAILED;
+    } else {
+        entry->error = open_output_file(entry->output_path, template_stat.st_mode,
+                                        tree->can_override, &output);
+    }
+
+    if(entry->error == TEMPLATE_OK) {
+        bool written;
+        if(tree->values) {
+            written = replace_stubs_fd(template_fd, output.fd, tree->values);
+        } else {
+            written = copy_fd_contents(template_fd, output.fd) != COPY_STRATEGY_FAILED;
+        }
+        entry->error = close_output_file(&output, entry->output_path, written);
+    }
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(template_fd);
+    STATS_FILE(file_timer);
+}
+
+// NOTE(erick): Generates output_dir from the template directory
+// template_dir. values is NULL for plain copies. The scaffold fails
+// with TEMPLATE_FILE_EXISTS if output_dir exists, unless can_override, in
+// which case the template is laid over it. update implies can_override.
+template_error generate_scaffold(char* template_dir, char* output_dir,
+                                 placeholder_values* values, bool can_override,
+                                 bool update) {
+    scaffold tree;
+    memset(&tree, 0, sizeof(scaffold));
+    tree.values = values;
+    tree.can_override = can_override || update;
+    tree.update = update;
+    tree.process_umask = output_umask();
+
+    struct stat template_stat;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(stat(template_dir, &template_stat) || !S_ISDIR(template_stat.st_mode)) {
+        return TEMPLATE_OPEN_TEMPLATE_FAILED;
+    }
+
+    arena scaffold_arena;
+    template_arena_init(&scaffold_arena, ARENA_DEFAULT_BLOCK_SIZE);
+    tree.allocator = template_arena_allocator(&scaffold_arena);
+
+    template_error result = make_scaffold_directory(&tree, template_dir, output_dir,
+                                                    template_stat.st_mode);
+    if(result == TEMPLATE_OK) {
+        result = walk_scaffold(&tree, template_dir, output_dir);
+    }
+
+    if(!template_error_is_failure(result)) {
+        int workers_count = tree.files_count / SCAFFOLD_FILES_PER_WORKER + 1;
+        if(workers_count > online_cpus_count()) {
+            workers_count = online_cpus_count();
+        }
+        run_in_parallel(generate_scaffold_file, &tree, tree.entries_count, workers_count);
+    }
+
+    // NOTE(erick): Children before their parents, a parent may stop being
+    // writable.
+    for(int entry_index = tree.entries_count - 1; entry_index >= 0; entry_index--) {
+        scaffold_entry* entry = tree.entries + entry_index;
+        if(entry->is_directory && entry->needs_chmod) {
+            STATS_SYSCALL(SYSCALL_CHMOD);
+            if(chmod(entry->output_path, entry->mode)) {
+                entry->error = TEMPLATE_MODE_NOT_SET;
+            }
+        }
+        if(entry->error > result) {
+            result = entry->error;
+        }
+    }
+
+    template_arena_free(&scaffold_arena);
+    return result;
+}
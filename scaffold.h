@@ -0,0 +1,14 @@
+#ifndef SCAFFOLD_H
+#define SCAFFOLD_H 1
+
+#include "default_definitions.h"
+#include "libtemplate.h"
+#include "placeholders.h"
+
+// NOTE(erick): A worker for every SCAFFOLD_FILES_PER_WORKER files, up to
+// the number of online CPUs.
+#define SCAFFOLD_FILES_PER_WORKER 16
+
+template_error generate_scaffold(char*, char*, placeholder_values*, bool, bool);
+
+#endif
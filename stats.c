@@ -0,0 +1,137 @@
+/* Counters behind --stats.
+ *
+ * The counters are global because the syscalls they count happen deep in
+ * the copy paths, on any worker. They are updated with relaxed atomics and
+ * only read once everything is done.
+ */
+
+#include <time.h>
+
+#include "stats.h"
+
+#if TEMPLATE_STATS
+
+run_stats template_stats;
+
+static const char* stage_names[STAGES_COUNT] = {
+    "template_dir", "template_lookup", "file_names", "template_files",
+    "compile", "generate", "sync", "report"
+};
+
+static const char* syscall_names[SYSCALLS_COUNT] = {
+    "open", "close", "read", "write", "stat", "chmod", "mmap", "copy_range",
+    "readdir", "link", "mkdir", "sync", "fadvise", "io_uring_enter"
+};
+
+uint64 stats_now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64) time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void stats_add_stage(stats_stage stage, uint64 start) {
+    __atomic_fetch_add(&template_stats.stage_ns[stage], stats_now() - start,
+                       __ATOMIC_RELAXED);
+}
+
+void stats_record_file(uint64 start) {
+    uint64 elapsed = stats_now() - start;
+
+    uint bucket = 0;
+    for(uint64 micros = elapsed / 1000; micros > 1 && bucket < STATS_LATENCY_BUCKETS - 1;
+        micros >>= 1) {
+        bucket++;
+    }
+
+    __atomic_fetch_add(&template_stats.files_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&template_stats.files_total_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&template_stats.file_latency_buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    uint64 max = __atomic_load_n(&template_stats.files_max_ns, __ATOMIC_RELAXED);
+    while(elapsed > max &&
+          !__atomic_compare_exchange_n(&template_stats.files_max_ns, &max, elapsed, TRUE,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { ; }
+}
+
+static void print_stats_text(FILE* output) {
+    run_stats* stats = &template_stats;
+
+    fprintf(output, "stages:\n");
+    for(int stage = 0; stage < STAGES_COUNT; stage++) {
+        fprintf(output, "  %-16s %12.3f ms\n", stage_names[stage],
+                stats->stage_ns[stage] / 1e6);
+    }
+
+    fprintf(output, "syscalls:\n");
+    for(int kind = 0; kind < SYSCALLS_COUNT; kind++) {
+        if(stats->syscalls[kind]) {
+            fprintf(output, "  %-16s %12llu\n", syscall_names[kind],
+                    (unsigned long long) stats->syscalls[kind]);
+        }
+    }
+
+    fprintf(output, "bytes read:    %llu\nbytes written: %llu\n",
+            (unsigned long long) stats->bytes_read,
+            (unsigned long long) stats->bytes_written);
+
+    if(stats->files_count == 0) {
+        return;
+    }
+
+    fprintf(output, "files: %llu, mean %.1f us, max %.1f us\n",
+            (unsigned long long) stats->files_count,
+            stats->files_total_ns / 1e3 / stats->files_count,
+            stats->files_max_ns / 1e3);
+    for(int bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++) {
+        if(stats->file_latency_buckets[bucket]) {
+            fprintf(output, "  < %10llu us %12llu\n", 2ULL << bucket,
+                    (unsigned long long) stats->file_latency_buckets[bucket]);
+        }
+    }
+}
+
+static void print_stats_json(FILE* output) {
+    run_stats* stats = &template_stats;
+
+    fprintf(output, "{\"stages_ns\":{");
+    for(int stage = 0; stage < STAGES_COUNT; stage++) {
+        fprintf(output, "%s\"%s\":%llu", stage ? "," : "", stage_names[stage],
+                (unsigned long long) stats->stage_ns[stage]);
+    }
+
+    fprintf(output, "},\"syscalls\":{");
+    for(int kind = 0; kind < SYSCALLS_COUNT; kind++) {
+        fprintf(output, "%s\"%s\":%llu", kind ? "," : "", syscall_names[kind],
+                (unsigned long long) stats->syscalls[kind]);
+    }
+
+    fprintf(output, "},\"bytes_read\":%llu,\"bytes_written\":%llu,"
+            "\"files\":%llu,\"file_total_ns\":%llu,\"file_max_ns\":%llu,"
+            "\"file_latency_us_buckets\":[",
+            (unsigned long long) stats->bytes_read,
+            (unsigned long long) stats->bytes_written,
+            (unsigned long long) stats->files_count,
+            (unsigned long long) stats->files_total_ns,
+            (unsigned long long) stats->files_max_ns);
+
+    // NOTE(erick): [upper bound in microseconds, count], empty buckets left out.
+    bool first = TRUE;
+    for(int bucket = 0; bucket < STATS_LATENCY_BUCKETS; bucket++) {
+        if(stats->file_latency_buckets[bucket]) {
+            fprintf(output, "%s[%llu,%llu]", first ? "" : ",", 2ULL << bucket,
+                    (unsigned long long) stats->file_latency_buckets[bucket]);
+            first = FALSE;
+        }
+    }
+    fprintf(output, "]}\n");
+}
+
+void print_run_stats(FILE* output, bool json) {
+    if(json) {
+        print_stats_json(output);
+    } else {
+        print_stats_text(output);
+    }
+}
+
+#endif
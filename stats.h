@@ -0,0 +1,85 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <stdio.h>
+#include "default_definitions.h"
+
+// NOTE(erick): Instrumentation for --stats. Unless the program is built
+// with -DTEMPLATE_STATS=1 all the STATS_ macros expand to nothing.
+
+typedef enum {
+    STAGE_TEMPLATE_DIR,
+    STAGE_TEMPLATE_LOOKUP,
+    STAGE_FILE_NAMES,
+    STAGE_TEMPLATE_FILES,
+    STAGE_COMPILE,
+    STAGE_GENERATE,
+    STAGE_SYNC,
+    STAGE_REPORT,
+    STAGES_COUNT
+} stats_stage;
+
+typedef enum {
+    SYSCALL_OPEN,
+    SYSCALL_CLOSE,
+    SYSCALL_READ,
+    SYSCALL_WRITE,
+    SYSCALL_STAT,
+    SYSCALL_CHMOD,
+    SYSCALL_MMAP,
+    SYSCALL_COPY_RANGE,
+    SYSCALL_READDIR,
+    SYSCALL_LINK,
+    SYSCALL_MKDIR,
+    SYSCALL_SYNC,
+    SYSCALL_FADVISE,
+    SYSCALL_IO_URING_ENTER,
+    SYSCALLS_COUNT
+} stats_syscall;
+
+// NOTE(erick): Bucket i counts the files that took less than 2^(i+1)
+// microseconds (and at least 2^i, except for the first one).
+#define STATS_LATENCY_BUCKETS 32
+
+#if TEMPLATE_STATS
+
+typedef struct {
+    uint64 stage_ns[STAGES_COUNT];
+    uint64 syscalls[SYSCALLS_COUNT];
+    uint64 bytes_read;
+    uint64 bytes_written;
+    uint64 files_count;
+    uint64 files_total_ns;
+    uint64 files_max_ns;
+    uint64 file_latency_buckets[STATS_LATENCY_BUCKETS];
+} run_stats;
+
+extern run_stats template_stats;
+
+uint64 stats_now();
+void stats_add_stage(stats_stage, uint64);
+void stats_record_file(uint64);
+void print_run_stats(FILE*, bool);
+
+#define STATS_TIMER(timer) uint64 timer = stats_now()
+#define STATS_STAGE(stage, timer) stats_add_stage(stage, timer)
+#define STATS_FILE(timer) stats_record_file(timer)
+#define STATS_SYSCALL(kind) \
+    __atomic_fetch_add(&template_stats.syscalls[kind], 1, __ATOMIC_RELAXED)
+#define STATS_BYTES_READ(count) \
+    __atomic_fetch_add(&template_stats.bytes_read, (uint64) (count), __ATOMIC_RELAXED)
+#define STATS_BYTES_WRITTEN(count) \
+    __atomic_fetch_add(&template_stats.bytes_written, (uint64) (count), __ATOMIC_RELAXED)
+
+#else
+
+#define STATS_TIMER(timer)
+#define STATS_STAGE(stage, timer)
+#define STATS_FILE(timer)
+#define STATS_SYSCALL(kind)
+#define STATS_BYTES_READ(count)
+#define STATS_BYTES_WRITTEN(count)
+
+#endif
+
+#endif
@@ -1,38 +1,101 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "string_buffer.h"
 #include "default_definitions.h"
 
-bool string_buffer_read_line(FILE* input_file, StringBuffer* buf) {
-    bool result = (!feof(input_file) && fgets(buf->buffer_data, buf->avaible_buffer_space, input_file));
+static bool string_buffer_reserve(StringBuffer* buf, size_t capacity) {
+    if(capacity <= buf->capacity) {
+        return TRUE;
+    }
 
-    if(!result) {
-        return result;
+    size_t new_capacity = buf->capacity ? buf->capacity : DEFAULT_STRING_BUFFER_SIZE;
+    while(new_capacity < capacity) {
+        new_capacity *= 2;
     }
 
-    uint string_len = strlen(buf->buffer_data);
+    char* new_data = (char*) realloc(buf->buffer_data, new_capacity);
+    if(!new_data) {
+        return FALSE;
+    }
 
-    bool end = 0;
-    while(!end && buf->buffer_data[string_len - 1] != '\n') {
-        buf->buffer_size *= 2;
-        uint avaible_buffer_space = buf->buffer_size - string_len;
-        buf->buffer_data = realloc(buf->buffer_data, buf->buffer_size);
+    buf->buffer_data = new_data;
+    buf->capacity = new_capacity;
+    return TRUE;
+}
 
-        end = !(!feof(input_file) && fgets(buf->buffer_data + string_len, avaible_buffer_space, input_file));
-        string_len = strlen(buf->buffer_data);
+// NOTE(erick): Reads a line without its '\n'. Every byte is only looked at
+// once more after fgets wrote it, so a line costs linear time however many
+// times the buffer had to grow. Returns FALSE at the end of the file (or if
+// we run out of memory in the middle of a line).
+bool string_buffer_read_line(FILE* input_file, StringBuffer* buf) {
+    buf->length = 0;
+    if(!string_buffer_reserve(buf, DEFAULT_STRING_BUFFER_SIZE)) {
+        return FALSE;
     }
+    buf->buffer_data[0] = '\0';
+
+    while(TRUE) {
+        size_t available_space = buf->capacity - buf->length;
+        if(available_space > INT_MAX) {
+            available_space = INT_MAX;
+        }
+
+        char* chunk = buf->buffer_data + buf->length;
+        if(!fgets(chunk, (int) available_space, input_file)) {
+            break;
+        }
+
+        size_t chunk_len = strlen(chunk);
+        buf->length += chunk_len;
+        if(ferror(input_file)) {
+            break;
+        }
 
-    if(string_len && buf->buffer_data[string_len - 1] == '\n') {
-        buf->buffer_data[string_len - 1] = '\0';
+        if(chunk_len && chunk[chunk_len - 1] == '\n') {
+            buf->buffer_data[--buf->length] = '\0';
+            return TRUE;
+        }
+
+        // NOTE(erick): fgets stops early at the end of the file, and a NUL
+        // inside the line makes the chunk look shorter. Only a full chunk
+        // means the line didn't fit.
+        if(chunk_len + 1 == available_space &&
+           !string_buffer_reserve(buf, buf->capacity + 1)) {
+            return FALSE;
+        }
     }
 
-    return result;
+    // NOTE(erick): The last line of a file may not end with a '\n'. A line
+    // cut short by a read error (e.g. a socket timeout) is dropped.
+    if(ferror(input_file)) {
+        return FALSE;
+    }
+    return buf->length > 0;
+}
+
+// NOTE(erick): Only the line ending goes (the '\r' of CRLF files included),
+// spaces and tabs before it can be data.
+void string_buffer_trim_line_end(StringBuffer* buf) {
+    while(buf->length &&
+          (buf->buffer_data[buf->length - 1] == '\n' ||
+           buf->buffer_data[buf->length - 1] == '\r')) {
+        buf->buffer_data[--buf->length] = '\0';
+    }
 }
 
 void string_buffer_init(StringBuffer* buf) {
-    buf->buffer_data = (char*) malloc(DEFAULT_STRING_BUFFER_SIZE * sizeof(char));
-    buf->avaible_buffer_space = DEFAULT_STRING_BUFFER_SIZE;
-    buf->buffer_size = 0;
+    buf->buffer_data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
+    string_buffer_reserve(buf, DEFAULT_STRING_BUFFER_SIZE);
+}
+
+void free_string_buffer(StringBuffer* buf) {
+    free(buf->buffer_data);
+    buf->buffer_data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
 }
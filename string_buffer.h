@@ -2,17 +2,22 @@
 #define BUFFERED_READER_H 1
 
 #include <stdio.h>
+#include <stddef.h>
 #include "default_definitions.h"
 
 #define DEFAULT_STRING_BUFFER_SIZE 1024
 
+// NOTE(erick): buffer_data is always NUL terminated, length doesn't count
+// the terminator and capacity does.
 typedef struct {
     char* buffer_data;
-    uint buffer_size;
-    uint avaible_buffer_space;
+    size_t length;
+    size_t capacity;
 } StringBuffer;
 
 bool string_buffer_read_line(FILE*, StringBuffer*);
+void string_buffer_trim_line_end(StringBuffer*);
 void string_buffer_init(StringBuffer*);
+void free_string_buffer(StringBuffer*);
 
 #endif
@@ -0,0 +1,151 @@
+/* Streams a file from one descriptor to another replacing every occurrence
+ * of a stub string, and the placeholders that start with it (see
+ * placeholders.c).
+ *
+ * The input is read in big chunks and scanned with memchr for the first
+ * character of the stub (libc's memchr is vectorized, so most of the chunk
+ * is skipped at memory speed). Literal spans and replacements are queued as
+ * iovecs pointing into the chunk and flushed with writev before the chunk
+ * is reused. A stub or placeholder that straddles two chunks is handled by
+ * carrying the last bytes over to the beginning of the next chunk.
+ *
+ * Nothing here looks at '\n' or '\0', so binary templates are copied verbatim.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "stub_replacer.h"
+#include "copy_engine.h"
+#include "stats.h"
+
+typedef struct {
+    struct iovec iovecs[REPLACE_MAX_IOVECS];
+    int iovecs_count;
+    int output_fd;
+} output_queue;
+
+static bool flush_output_queue(output_queue* queue) {
+    bool result = write_iovecs(queue->output_fd, queue->iovecs, queue->iovecs_count);
+    queue->iovecs_count = 0;
+    return result;
+}
+
+static bool queue_output(output_queue* queue, char* data, size_t data_len) {
+    if(data_len == 0) {
+        return TRUE;
+    }
+
+    if(queue->iovecs_count == REPLACE_MAX_IOVECS && !flush_output_queue(queue)) {
+        return FALSE;
+    }
+
+    queue->iovecs[queue->iovecs_count].iov_base = data;
+    queue->iovecs[queue->iovecs_count].iov_len = data_len;
+    queue->iovecs_count++;
+    return TRUE;
+}
+
+bool replace_stubs_fd(int input_fd, int output_fd, placeholder_values* values) {
+    size_t stub_len = values->stub_len;
+    placeholder_set* set = values->set;
+
+    if(stub_len == 0) {
+        return FALSE;
+    }
+
+    // NOTE(erick): A stub is only looked at with the longest placeholder
+    // it could open ahead of it, or at the end of the file.
+    size_t lookahead = stub_len + (set ? set->max_key_len + set->stub_len : 0);
+
+    // NOTE(erick): The chunk has room for the bytes carried from the
+    // previous read in front of a full read.
+    char* chunk = (char*) malloc(REPLACE_CHUNK_SIZE + lookahead);
+    if(!chunk) {
+        return FALSE;
+    }
+
+    output_queue queue;
+    queue.iovecs_count = 0;
+    queue.output_fd = output_fd;
+
+    bool result = TRUE;
+    size_t carried = 0;
+    bool reached_eof = FALSE;
+
+    while(!reached_eof) {
+        ssize_t n_read = read(input_fd, chunk + carried, REPLACE_CHUNK_SIZE);
+        STATS_SYSCALL(SYSCALL_READ);
+        if(n_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n_read < 0) {
+            result = FALSE;
+            break;
+        }
+        STATS_BYTES_READ(n_read);
+        reached_eof = (n_read == 0);
+
+        char* chunk_end = chunk + carried + n_read;
+        char* literal_start = chunk;
+        char* cursor = chunk;
+        size_t needed = reached_eof ? stub_len : lookahead;
+
+        // NOTE(erick): Only positions with enough bytes ahead of them are
+        // searched, a stub starting later may continue in the next chunk.
+        while(chunk_end - cursor >= (ssize_t) needed) {
+            cursor = (char*) memchr(cursor, values->stub[0], (chunk_end - cursor) - needed + 1);
+            if(!cursor) {
+                break;
+            }
+
+            if(memcmp(cursor, values->stub, stub_len) == 0) {
+                char* value = values->stub_value;
+                size_t value_len = values->stub_value_len;
+                size_t placeholder_len = 0;
+                int key = find_placeholder(set, (uint8*) cursor + stub_len,
+                                           chunk_end - (cursor + stub_len), &placeholder_len);
+                if(key != PLACEHOLDER_NO_KEY) {
+                    value = values->values[key];
+                    value_len = values->value_lens[key];
+                }
+
+                if(!queue_output(&queue, literal_start, cursor - literal_start) ||
+                   !queue_output(&queue, value, value_len)) {
+                    result = FALSE;
+                    break;
+                }
+                cursor += stub_len + placeholder_len;
+                literal_start = cursor;
+            } else {
+                cursor++;
+            }
+        }
+
+        if(!result) {
+            break;
+        }
+
+        char* keep_from = chunk_end;
+        if(!reached_eof && chunk_end - literal_start > (ssize_t) (lookahead - 1)) {
+            keep_from = chunk_end - (lookahead - 1);
+        } else if(!reached_eof) {
+            keep_from = literal_start;
+        }
+
+        if(!queue_output(&queue, literal_start, keep_from - literal_start) ||
+           !flush_output_queue(&queue)) {
+            result = FALSE;
+            break;
+        }
+
+        carried = chunk_end - keep_from;
+        memmove(chunk, keep_from, carried);
+    }
+
+    free(chunk);
+    return result;
+}
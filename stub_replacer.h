@@ -0,0 +1,13 @@
+#ifndef STUB_REPLACER_H
+#define STUB_REPLACER_H 1
+
+#include <stddef.h>
+#include "default_definitions.h"
+#include "placeholders.h"
+
+#define REPLACE_CHUNK_SIZE MEGA(1)
+#define REPLACE_MAX_IOVECS 256
+
+bool replace_stubs_fd(int, int, placeholder_values*);
+
+#endif
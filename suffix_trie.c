@@ -0,0 +1,187 @@
+/* Trie of reversed template extensions.
+ *
+ * Every suffix of a template name that follows a dot is an extension the
+ * template can be used for: "foo.test.cpp" provides "test.cpp" and "cpp".
+ * Since they are stored reversed, all the extensions of a name share a
+ * single path from the root, and finding the longest extension of a file
+ * is a single walk from the end of its name, no matter how many templates
+ * there are.
+ */
+
+#include <string.h>
+
+#include "suffix_trie.h"
+
+static uint hash_edge(uint parent, uint8 byte) {
+    uint64 key = ((uint64) parent << 8) | byte;
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (uint) (key >> 32);
+}
+
+static void insert_edge(suffix_trie_edge* edges, uint edges_mask,
+                        uint parent, uint8 byte, uint child) {
+    uint slot = hash_edge(parent, byte) & edges_mask;
+    while(edges[slot].child != SUFFIX_TRIE_ROOT) {
+        slot = (slot + 1) & edges_mask;
+    }
+
+    edges[slot].parent = parent;
+    edges[slot].byte = byte;
+    edges[slot].child = child;
+}
+
+static bool grow_edges(suffix_trie* trie) {
+    uint new_mask = trie->edges_mask * 2 + 1;
+    suffix_trie_edge* new_edges = (suffix_trie_edge*) allocate_zeroed(
+        trie->allocator, new_mask + 1, sizeof(suffix_trie_edge));
+    if(!new_edges) {
+        return FALSE;
+    }
+
+    for(uint slot = 0; slot <= trie->edges_mask; slot++) {
+        suffix_trie_edge* edge = trie->edges + slot;
+        if(edge->child != SUFFIX_TRIE_ROOT) {
+            insert_edge(new_edges, new_mask, edge->parent, edge->byte, edge->child);
+        }
+    }
+
+    release_memory(trie->allocator, trie->edges,
+                   (trie->edges_mask + 1) * sizeof(suffix_trie_edge));
+    trie->edges = new_edges;
+    trie->edges_mask = new_mask;
+    return TRUE;
+}
+
+static uint find_child(suffix_trie* trie, uint parent, uint8 byte) {
+    uint slot = hash_edge(parent, byte) & trie->edges_mask;
+    while(trie->edges[slot].child != SUFFIX_TRIE_ROOT) {
+        suffix_trie_edge* edge = trie->edges + slot;
+        if(edge->parent == parent && edge->byte == byte) {
+            return edge->child;
+        }
+        slot = (slot + 1) & trie->edges_mask;
+    }
+
+    return SUFFIX_TRIE_ROOT;
+}
+
+// NOTE(erick): Returns SUFFIX_TRIE_ROOT if we run out of memory.
+static uint add_child(suffix_trie* trie, uint parent, uint8 byte) {
+    if(trie->nodes_count == trie->nodes_capacity) {
+        uint new_capacity = trie->nodes_capacity * 2;
+        suffix_trie_node* new_nodes = (suffix_trie_node*) reallocate_memory(
+            trie->allocator, trie->nodes,
+            trie->nodes_capacity * sizeof(suffix_trie_node),
+            new_capacity * sizeof(suffix_trie_node));
+        if(!new_nodes) {
+            return SUFFIX_TRIE_ROOT;
+        }
+        trie->nodes = new_nodes;
+        trie->nodes_capacity = new_capacity;
+    }
+
+    // NOTE(erick): Keeping the edge table at most half full.
+    if(2 * (trie->edges_count + 1) > trie->edges_mask + 1 && !grow_edges(trie)) {
+        return SUFFIX_TRIE_ROOT;
+    }
+
+    uint child = trie->nodes_count++;
+    trie->nodes[child].template_entry = NO_TEMPLATE;
+    trie->nodes[child].extra_components = 0;
+
+    insert_edge(trie->edges, trie->edges_mask, parent, byte, child);
+    trie->edges_count++;
+    return child;
+}
+
+bool suffix_trie_init(suffix_trie* trie, template_allocator* allocator) {
+    trie->allocator = allocator;
+    trie->nodes_capacity = 64;
+    trie->nodes = (suffix_trie_node*) allocate_memory(allocator, trie->nodes_capacity *
+                                                      sizeof(suffix_trie_node));
+    trie->edges_mask = 127;
+    trie->edges = (suffix_trie_edge*) allocate_zeroed(allocator, trie->edges_mask + 1,
+                                                      sizeof(suffix_trie_edge));
+    if(!trie->nodes || !trie->edges) {
+        free_suffix_trie(trie);
+        return FALSE;
+    }
+
+    trie->nodes[SUFFIX_TRIE_ROOT].template_entry = NO_TEMPLATE;
+    trie->nodes[SUFFIX_TRIE_ROOT].extra_components = 0;
+    trie->nodes_count = 1;
+    trie->edges_count = 0;
+    return TRUE;
+}
+
+bool suffix_trie_insert_template(suffix_trie* trie, char* template_name,
+                                 int template_entry) {
+    int name_len = strlen(template_name);
+
+    // NOTE(erick): The dot at position 0 of a hidden file doesn't start an
+    // extension, the name has to have something before the dot.
+    uint dots_before = 0;
+    for(int i = 1; i < name_len; i++) {
+        dots_before += (template_name[i] == '.');
+    }
+
+    uint node = SUFFIX_TRIE_ROOT;
+    for(int i = name_len - 1; i >= 2 && dots_before > 0; i--) {
+        uint8 byte = (uint8) template_name[i];
+        uint child = find_child(trie, node, byte);
+        if(child == SUFFIX_TRIE_ROOT) {
+            child = add_child(trie, node, byte);
+            if(child == SUFFIX_TRIE_ROOT) {
+                return FALSE;
+            }
+        }
+        node = child;
+
+        if(byte == '.') {
+            continue;
+        }
+
+        if(template_name[i - 1] == '.') {
+            dots_before--;
+            suffix_trie_node* current = trie->nodes + node;
+            if(current->template_entry == NO_TEMPLATE ||
+               dots_before < current->extra_components) {
+                current->template_entry = template_entry;
+                current->extra_components = dots_before;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+int suffix_trie_find_template(suffix_trie* trie, char* extension) {
+    int extension_len = strlen(extension);
+    int result = NO_TEMPLATE;
+    uint node = SUFFIX_TRIE_ROOT;
+
+    for(int i = extension_len - 1; i >= 0; i--) {
+        node = find_child(trie, node, (uint8) extension[i]);
+        if(node == SUFFIX_TRIE_ROOT) {
+            break;
+        }
+
+        // NOTE(erick): Only whole components count. The extension itself
+        // always follows a dot in the file name.
+        bool at_component_start = (i == 0 || extension[i - 1] == '.');
+        if(at_component_start && trie->nodes[node].template_entry != NO_TEMPLATE) {
+            result = trie->nodes[node].template_entry;
+        }
+    }
+
+    return result;
+}
+
+void free_suffix_trie(suffix_trie* trie) {
+    release_memory(trie->allocator, trie->nodes,
+                   trie->nodes_capacity * sizeof(suffix_trie_node));
+    release_memory(trie->allocator, trie->edges,
+                   (trie->edges_mask + 1) * sizeof(suffix_trie_edge));
+    trie->nodes = NULL;
+    trie->edges = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef SUFFIX_TRIE_H
+#define SUFFIX_TRIE_H 1
+
+#include "default_definitions.h"
+#include "allocator.h"
+
+#define NO_TEMPLATE (-1)
+#define SUFFIX_TRIE_ROOT 0
+
+// NOTE(erick): A node is the end of an extension when template_entry is
+// set. extra_components counts how many more dot separated components
+// the template name has before that extension, so "c.cpp" is preferred
+// over "test.c.cpp" for the extension "cpp".
+typedef struct {
+    int template_entry;
+    uint extra_components;
+} suffix_trie_node;
+
+// NOTE(erick): The children of all the nodes live in a single hash table
+// keyed by (parent, byte). child == SUFFIX_TRIE_ROOT marks an empty slot
+// since the root is nobody's child.
+typedef struct {
+    uint parent;
+    uint child;
+    uint8 byte;
+} suffix_trie_edge;
+
+typedef struct {
+    suffix_trie_node* nodes;
+    uint nodes_count;
+    uint nodes_capacity;
+
+    suffix_trie_edge* edges;
+    uint edges_count;
+    uint edges_mask;
+
+    template_allocator* allocator;
+} suffix_trie;
+
+bool suffix_trie_init(suffix_trie*, template_allocator*);
+bool suffix_trie_insert_template(suffix_trie*, char*, int);
+int suffix_trie_find_template(suffix_trie*, char*);
+void free_suffix_trie(suffix_trie*);
+
+#endif
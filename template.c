@@ -11,21 +11,36 @@
  * the "???" is replaced with STR. If -r is the last argument and STR is omitted,
  * the default behavior is to replace "???" with the filename in uppercase
  * with all its non-alphanumeric characters replaced with '_' (for use with C header files).
+ * In the same files "???NAME???", "???GUARD???" and "???STEM???" are replaced
+ * with forms of the filename, and -D KEY=VALUE replaces "???KEY???" with VALUE.
+ * The template directory is XDG_TEMPLATES_DIR from user-dirs.dirs. It can be
+ * overridden with -t [DIR] or the TEMPLATE_DIR environment variable.
+ * --dedupe writes outputs that would be identical only once and clones the
+ * rest from it (--dedupe=hardlink links them instead).
+ * --durability=batch syncs the file systems of the outputs once at the
+ * end of the run, --durability=file syncs every output and its directory.
+ * --update overrides the outputs whose contents would change and leaves
+ * the others (and their mtimes) alone.
+ * --pack FILE writes the whole template directory to FILE, which can then
+ * be used as the template directory itself (see template_pack.c).
+ * --stats (or --stats=json) prints where the time of the run went. It is
+ * only available when built with -DTEMPLATE_STATS=1.
 
  * Erick Pires - 25/12/14
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <dirent.h>
 #include <string.h>
-#include <fcntl.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <sys/stat.h>
+#include <limits.h>
 
 #include "template.h"
+#include "stats.h"
 #include "string_buffer.h"
 
 #define starts_with(str,ch) (*str == ch)
@@ -52,67 +67,6 @@ void eat_argument(int argc, char** argv, int index, char** dest) {
     argv[index] = NULL;
 }
 
-inline void trim_right(char* str){
-    int len = strlen(str);
-
-    int i  = len - 1;
-
-    while( i >= 0 &&
-           ( str[i] == '\n' ||
-             str[i] == '\t' ||
-             str[i] == ' ')) {
-        str[i--] = '\0';
-    }
-}
-
-inline int matches_file_format(char* filename, char* file_extension) {
-    int end_filename = strlen(filename);
-    int end_file_extension = strlen(file_extension);
-
-    int index_filename = end_filename - 1;
-    int index_file_extension = end_file_extension - 1;
-
-    // NOTE(erick): The filename has to be bigger than the extension by
-    // at least two characters (one of them been the dot)
-    if(index_filename < index_file_extension + 2) {
-        return 0;
-    }
-
-    // NOTE(erick): We do not support template files without extension
-    if(index_file_extension < 0) {
-        return 0;
-    }
-
-    while(filename[index_filename] == file_extension[index_file_extension]) {
-        // NOTE(erick): When the extension ends, we check if we are on a dot ('.')
-        // in the filename in which case we return true.
-        if(index_file_extension == 0) {
-            if(filename[index_filename - 1] == '.') {
-                return 1;
-            } else {
-                return 0;
-            }
-        }
-
-        index_filename--;
-        index_file_extension--;
-    }
-
-    return 0;
-}
-
-inline char* copy_string(char* dest, char* src){
-    //NOTE: copies all the characters from src to dest and
-    //returns a pointer to last character of dest.
-
-    while(*src) {
-        *dest++ = *src++;
-    }
-
-    *dest++ = '\0';
-    return dest;
-}
-
 void fill_files_to_output_paths(int argc, char** argv,
                                 file_data* files_to_output,
                                 char* destination_dir,
@@ -126,6 +80,8 @@ void fill_files_to_output_paths(int argc, char** argv,
         if(starts_with(current_argument, '-')) { // It's an option
             current_argument++;
             switch(*current_argument) {
+            case '-' : // Long options were handled by the first pass
+                break;
             case 'o' :
                 files_to_output->can_override = TRUE;
                 break;
@@ -142,6 +98,10 @@ void fill_files_to_output_paths(int argc, char** argv,
                 eat_argument(argc, argv, arg_index, &(files_to_output->replace_string));
                 break;
             case 'd' :
+            case 't' :
+            case 'D' :
+            case 'i' :
+            case 'j' :
                 break;
             default :
                 exit_on_error("Unknown option '%c'.\n", *current_argument);
@@ -172,272 +132,301 @@ void fill_files_to_output_paths(int argc, char** argv,
     }
 }
 
-void get_files_extensions(file_data* files_to_output, int files_to_output_count) {
-    for(int i = 0; i < files_to_output_count; i++){
-        if(files_to_output[i].file_extension == NULL) {
-            int pos = strlen(files_to_output[i].file_path) - 1;
-            while(files_to_output[i].file_path[pos] != '.' && pos > 0){ //TODO: extremely confusing
-                pos--;
-            }
-            if(pos == 0) {
-                exit_on_error("You must specify an extension.\n"
-                              " '%s'\n", files_to_output[i].file_path);
-            }
-
-            files_to_output[i].file_extension = files_to_output[i].file_path + pos + 1;
-        }
+void print_file_diagnostic(file_data* file, FILE* output) {
+    switch(file->error) {
+    case TEMPLATE_OK :
+    case TEMPLATE_UNCHANGED :
+        break;
+    case TEMPLATE_FILE_EXISTS :
+        fprintf(output, "File: %s already exists.\n"
+                "This file was ignored. To override it, please use '-o'\n",
+                file->file_path);
+        break;
+    case TEMPLATE_MODE_NOT_SET :
+        fprintf(output, "Could not set the mode of %s\n", file->file_path);
+        break;
+    case TEMPLATE_NO_EXTENSION :
+        fprintf(output, "You must specify an extension.\n '%s'\n", file->file_path);
+        break;
+    case TEMPLATE_NO_TEMPLATE :
+        fprintf(output, "Could not find a matching template for \"%s\"\n",
+                file->filename);
+        break;
+    case TEMPLATE_OPEN_TEMPLATE_FAILED :
+        fprintf(output, "Could not open the file: \"%s\"\n", file->template_file_path);
+        break;
+    case TEMPLATE_OPEN_OUTPUT_FAILED :
+        fprintf(output, "Could not open the file: \"%s\"\n", file->file_path);
+        break;
+    case TEMPLATE_WRITE_FAILED :
+        fprintf(output, "Failed to write the complete input to the output file:"
+                " \"%s\"\n", file->file_path);
+        break;
+    case TEMPLATE_TEMPLATE_MODE_FAILED :
+        fprintf(output, "Could not get the mode of %s\n", file->template_file_path);
+        break;
+    default :
+        fprintf(output, "%s: \"%s\"\n", template_error_string(file->error),
+                file->file_path);
+        break;
     }
 }
 
-void get_files_names(file_data* files, int files_count) {
-    // NOTE(erick): We now support absolute paths, so we can't count on
-    // the destination directory been always the same (as we did before).
-    // We have to iterate backwards in the file_path until we find a '/'.
-    // Note the a slash will always be found since an absolute path starts
-    // with a slash and the relative paths are concatenated with a the
-    // destination directory and a '/'.
+int report_file_diagnostics(file_data* files, int files_count, FILE* output) {
+    // NOTE(erick): Diagnostics are printed only after all the files were
+    // processed, in the order the files were given, so the output doesn't
+    // depend on which worker finished first.
+    int failed_count = 0;
     for(int file_index = 0; file_index < files_count; file_index++) {
         file_data* current_file = files + file_index;
-        int file_path_len = strlen(current_file->file_path);
-
-        if(file_path_len == 0) {
-            exit_on_error("Internal bug: File path can't be empty"
-                          " file_index was: %d\n", file_index);
-        }
-        // Loop until a '/' is found or cursor reaches the beginning of
-        // the filename. This second condition should not happen as stated
-        // above.
-        char* cursor;
-        for(cursor = current_file->file_path + (file_path_len - 1);
-            *cursor != '/' && cursor > current_file->file_path;
-            cursor--) { ; }
-
-        // 'cursor + 1' is always valid since we subtract 1 from the length.
-        current_file->filename = cursor + 1;
+        print_file_diagnostic(current_file, output);
+        failed_count += current_file->failed;
     }
-}
 
-DIR* get_template_dir(char* template_dir_name_buffer) {
-
-    FILE* xdg_result = NULL;
-    //NOTE: Since we only have access to the stdin stream
-    //      The error stream is redirected so we can read it.
-    xdg_result = popen("xdg-user-dir TEMPLATES 2>&1", "r");
+    return failed_count;
+}
 
-    if(!xdg_result) {
-        exit_on_error("Failed to use popen\n");
+// NOTE(erick): Files with the same output as another one wait for it, they
+// are made in a second round.
+static void copy_file_work(void* files, int file_index) {
+    file_data* file = (file_data*) files + file_index;
+    if(!file->same_output_as) {
+        copy_file(file);
     }
+}
 
-    fgets(template_dir_name_buffer, 256, xdg_result);
-
-    pclose(xdg_result);
-
-    if(strstr(template_dir_name_buffer, "sh:")) {
-        exit_on_error("Could not execute xdg-user-dir\n");
+static void copy_duplicate_work(void* files, int file_index) {
+    file_data* file = (file_data*) files + file_index;
+    if(file->same_output_as) {
+        copy_duplicate_file(file);
     }
-
-    trim_right(template_dir_name_buffer); // Remove the last new line
-
-    return opendir(template_dir_name_buffer);
 }
 
-void get_template_files(file_data* files, int files_count,
-                        DIR* template_dir, char* template_dir_name){
-
-    int completed_files = 0;
-    dir_ent* template_file_dir_ent;
-
-    while((template_file_dir_ent = readdir(template_dir))) {
-        char* template_file_full_path = NULL;
-        char* current_template_filename = template_file_dir_ent->d_name;
-
-        // NOTE(erick): Ignore dir_ent '.' and '..'
-        if(strcmp(current_template_filename, ".") == 0 ||
-           strcmp(current_template_filename, "..") == 0) {
-            continue;
-        }
-
-        for(int i = 0; i < files_count; i++){
-            if(matches_file_format(current_template_filename,
-                                   files[i].file_extension)) {
-
-                if(template_file_full_path == NULL) {
-
-                    template_file_full_path = (char*) malloc(
-                        strlen(template_dir_name) +
-                        strlen(current_template_filename) +
-                        strlen("/") + 1);
-
-                    if(!template_file_full_path) {
-                        exit_on_error("Could not allocate memory\n");
-                    }
-
-                    strcpy(template_file_full_path, template_dir_name);
-                    strcat(template_file_full_path, "/");
-                    strcat(template_file_full_path, current_template_filename);
-                }
-
-                files[i].template_file_path = template_file_full_path;
-                completed_files++;
+int generate_files(file_data* files, int files_count,
+                   template_lookup* lookup, run_config* config) {
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        files[file_index].placeholders = &config->placeholders;
+        files[file_index].durability = config->durability;
+    }
 
-                if(completed_files == files_count) {
-                    return;
-                }
-            }
-        }
+    STATS_TIMER(names_timer);
+    get_files_names(files, files_count);
+    get_files_extensions(files, files_count);
+    STATS_STAGE(STAGE_FILE_NAMES, names_timer);
+
+    STATS_TIMER(templates_timer);
+    get_template_files(files, files_count, lookup);
+    STATS_STAGE(STAGE_TEMPLATE_FILES, templates_timer);
+
+    STATS_TIMER(compile_timer);
+    compile_templates(files, files_count, lookup,
+                      config->use_io_uring || config->keep_templates_in_memory ||
+                      config->dedupe != DEDUPE_NONE);
+    int duplicates_count = find_duplicate_outputs(files, files_count, config->dedupe,
+                                                  config->allocator);
+    STATS_STAGE(STAGE_COMPILE, compile_timer);
+
+    // NOTE(erick): Without io_uring support we silently use the workers.
+    STATS_TIMER(generate_timer);
+    if(!config->use_io_uring || !generate_files_with_uring(files, files_count)) {
+        run_in_parallel(copy_file_work, files, files_count, config->workers_count);
+    }
+    if(duplicates_count) {
+        run_in_parallel(copy_duplicate_work, files, files_count, config->workers_count);
     }
+    close_prefetched_templates(files, files_count);
+    STATS_STAGE(STAGE_GENERATE, generate_timer);
 
-    if(files_count != completed_files) {
-        fprintf(stderr, "Error:\n");
+    // NOTE(erick): Manifests sync once per batch.
+    STATS_TIMER(sync_timer);
+    make_outputs_durable(files, files_count, config->durability, config->workers_count);
+    STATS_STAGE(STAGE_SYNC, sync_timer);
 
-        for(int i = 0; i < files_count; i++) {
-            if(files[i].template_file_path == NULL) {
-                fprintf(stderr, "\t\"%s\"\n", files[i].filename);
-            }
-        }
+    STATS_TIMER(report_timer);
+    int failed_count = report_file_diagnostics(files, files_count,
+                                               config->diagnostics_output);
+    STATS_STAGE(STAGE_REPORT, report_timer);
 
-        exit_on_error("Could not find matching templates for the files above\n");
-    }
+    return failed_count;
 }
 
-char* make_replace_str(char* filename){
-    char* result = (char*) calloc(strlen(filename) + 1, sizeof(char));
-    if(!result) {
-        exit_on_error("make_replace_str: Could not allocate memory\n");
+// NOTE(erick): Ends the field at the next tab and returns the one after it.
+static char* next_manifest_field(char* field) {
+    char* next_field = field ? strchr(field, '\t') : NULL;
+    if(next_field) {
+        *next_field++ = '\0';
     }
+    return next_field;
+}
 
-    for(int i = 0; i < strlen(filename); i++) {
-        if(isalpha(filename[i])) {
-            result[i] = filename[i] & (~0x20);
-        } else {
-            result[i] = '_';
-        }
+// NOTE(erick): Copies a manifest field into the batch memory. Returns
+// NULL for empty fields.
+static char* push_manifest_field(char** batch_memory, char* field) {
+    if(!field || *field == '\0') {
+        return NULL;
     }
-    return result;
-}
 
-inline bool file_exists(char* file_path) {
-    return access(file_path, F_OK) == 0;
+    char* result = *batch_memory;
+    *batch_memory = copy_string(*batch_memory, field);
+    return result;
 }
 
-void copy_without_replacement(char* template_file_path, char* output_file_path) {
-    FILE* template_file = fopen(template_file_path, "rb");
-    if(!template_file) {
-        exit_on_error("Could not open the file: \"%s\"\n", template_file_path);
+int generate_manifest_files(char* manifest_path, template_lookup* lookup,
+                            run_config* config, int* total_count) {
+    FILE* manifest = stdin;
+    if(strcmp(manifest_path, "-") != 0) {
+        manifest = fopen(manifest_path, "r");
+        if(!manifest) {
+            exit_on_error("Could not open the manifest: \"%s\"\n", manifest_path);
+        }
     }
 
-    FILE* output_file = fopen(output_file_path, "wb");
+    int failed_count = generate_manifest_stream(manifest, lookup, config, total_count);
 
-    uint8 buffer[BUFFER_SIZE];
-    if(!output_file) {
-        exit_on_error("Could not open the file: \"%s\"\n", output_file_path);
+    if(manifest != stdin) {
+        fclose(manifest);
     }
 
-    while(TRUE) {
-        size_t n_read = fread(buffer, sizeof(uint8), BUFFER_SIZE, template_file);
-        if(n_read == 0) {
-            break;
-        }
-
-        size_t n_written = fwrite(buffer, sizeof(uint8), n_read, output_file);
+    return failed_count;
+}
 
-        if(n_written != n_read) {
-            exit_on_error("Failed to write the complete input to the output file:"
-                          " \"%s\"\n", output_file_path);
-        }
+int generate_manifest_stream(FILE* manifest, template_lookup* lookup,
+                             run_config* config, int* total_count) {
+    // NOTE(erick): A record is a line with up to four tab separated fields:
+    //     PATH [TAB REPLACE_STRING [TAB EXTENSION [TAB FLAGS]]]
+    // An empty REPLACE_STRING copies the template as is and "-" derives it
+    // from the filename (like -r). FLAGS may contain 'o' to override the
+    // file (like -o) and 'u' to override it only if it changed (like
+    // --update). Records are processed MANIFEST_BATCH_SIZE at a time
+    // with a fixed amount of memory, however long the manifest is.
+
+    size_t destination_dir_len = strlen(config->destination_dir);
+    size_t batch_memory_size = MANIFEST_BATCH_MEMORY;
+    file_data* files = (file_data*) allocate_memory(config->allocator,
+                                                    MANIFEST_BATCH_SIZE * sizeof(file_data));
+    char* batch_memory_start = (char*) allocate_memory(config->allocator,
+                                                       batch_memory_size);
+    if(!batch_memory_start || !files) {
+        exit_on_error("Failed to allocate memory\n");
     }
 
-    fclose(template_file);
-    fclose(output_file);
-}
+    StringBuffer string_buffer;
+    string_buffer_init(&string_buffer);
 
-void copy_file(file_data* file) {
-    stat_buf stat_buffer;
-    char* template_file_path = file->template_file_path;
-    char* output_file_path = file->file_path;
-
-    // NOTE(erick): We could have a race condition where the file is
-    // create (or modified, renamed, deleted, etc) after this check
-    // and before we actually open the file. It would be safer to
-    // just open the file and then check if we succeed.
-    if(!file->can_override && file_exists(output_file_path)) {
-        fprintf(stderr, "File: %s already exists.\n", output_file_path);
-        fprintf(stderr, "This file was ignored. To override it, please use '-o'\n");
-        return;
-    }
+    int failed_count = 0;
+    int files_count = 0;
+    char* batch_memory = batch_memory_start;
+    bool has_line = TRUE;
 
-    if(file->replace == REPLACE_WITH_NAME) {
-        file->replace_string = make_replace_str(file->filename);
-    }
+    while(has_line) {
+        has_line = string_buffer_read_line(manifest, &string_buffer);
+        char* line = string_buffer.buffer_data;
 
-    if(file->replace == DONT_REPLACE) {
-        copy_without_replacement(template_file_path, output_file_path);
-    } else {
-        FILE* template_file = fopen(template_file_path, "r");
-        if(!template_file) {
-            exit_on_error("Could not open the file: \"%s\"\n", template_file_path);
+        // NOTE(erick): Lines with nothing but spaces and tabs are blank.
+        if(has_line) {
+            string_buffer_trim_line_end(&string_buffer);
+            if(strspn(line, " \t") == string_buffer.length) {
+                continue;
+            }
         }
 
-       FILE* output_file = fopen(output_file_path, "w");
-        if(!output_file) {
-            exit_on_error("Could not open the file: \"%s\"\n", output_file_path);
+        // NOTE(erick): Worst case for a record: the destination dir, '/'
+        // and the three fields with their '\0'.
+        size_t record_size = has_line ? destination_dir_len + string_buffer.length + 4 : 0;
+        size_t used_memory = batch_memory - batch_memory_start;
+
+        if(files_count == MANIFEST_BATCH_SIZE ||
+           used_memory + record_size > batch_memory_size ||
+           (!has_line && files_count)) {
+            failed_count += generate_files(files, files_count, lookup, config);
+            *total_count += files_count;
+            files_count = 0;
+            batch_memory = batch_memory_start;
         }
 
-        StringBuffer string_buffer;
-        string_buffer_init(&string_buffer);
+        if(!has_line) {
+            break;
+        }
 
-        while(string_buffer_read_line(template_file, &string_buffer)) {
-            char* stub_pos = strstr(string_buffer.buffer_data, STUB_STR);
-            if(!stub_pos) {
-                fprintf(output_file, "%s\n", string_buffer.buffer_data);
-            } else {
-                *stub_pos = '\0';
-                fprintf(output_file, "%s", string_buffer.buffer_data);
-                fprintf(output_file, "%s", file->replace_string);
-                fprintf(output_file, "%s\n", stub_pos + strlen(STUB_STR));
+        if(record_size > batch_memory_size) {
+            // NOTE(erick): The batch is empty here, nothing points to the
+            // old memory.
+            release_memory(config->allocator, batch_memory_start, batch_memory_size);
+            batch_memory_size = record_size;
+            batch_memory_start = (char*) allocate_memory(config->allocator,
+                                                         batch_memory_size);
+            if(!batch_memory_start) {
+                exit_on_error("Failed to allocate memory\n");
             }
+            batch_memory = batch_memory_start;
         }
 
-        fclose(template_file);
-        fclose(output_file);
-    }
+        char* path = line;
+        char* replace_field = next_manifest_field(path);
+        char* extension_field = next_manifest_field(replace_field);
+        char* flags_field = next_manifest_field(extension_field);
 
-    if(file->replace == REPLACE_WITH_NAME) {
-        free(file->replace_string);
-    }
+        // NOTE(erick): Trailing spaces are data in REPLACE_STRING, they are
+        // only stripped from the other fields.
+        trim_right(path);
+        if(extension_field) {
+            trim_right(extension_field);
+        }
+        if(flags_field) {
+            trim_right(flags_field);
+        }
 
-    // NOTE(erick): Copying mode bits from one file the other
-    if(stat(template_file_path, &stat_buffer)) {
-        exit_on_error("Could not get the mode of %s\n", template_file_path);
-    }
+        file_data* file = files + files_count++;
+        memset(file, 0, sizeof(file_data));
+        file->update = config->update_files || (flags_field && strchr(flags_field, 'u'));
+        file->can_override = config->override_manifest_files || file->update ||
+            (flags_field && strchr(flags_field, 'o'));
+
+        file->file_path = batch_memory;
+        if(!is_absolute_path(path)) {
+            batch_memory = copy_string(batch_memory, config->destination_dir);
+            batch_memory--;
+            batch_memory = copy_string(batch_memory, "/");
+            batch_memory--;
+        }
+        batch_memory = copy_string(batch_memory, path);
 
-    mode_t file_mode = stat_buffer.st_mode;
-#if DEBUG
-    printf("Mode of %s is %o\n", template_file_path, file_mode);
-#endif
+        file->replace_string = push_manifest_field(&batch_memory, replace_field);
+        file->file_extension = push_manifest_field(&batch_memory, extension_field);
 
-    if(chmod(output_file_path, file_mode)) {
-        fprintf(stderr, "Could not set the mode of %s\n", output_file_path);
-        return;
+        if(file->replace_string == NULL) {
+            file->replace = DONT_REPLACE;
+        } else if(strcmp(file->replace_string, "-") == 0) {
+            file->replace = REPLACE_WITH_NAME;
+        } else {
+            file->replace = REPLACE_WITH_ARGUMENT;
+        }
     }
+
+    free_string_buffer(&string_buffer);
+    release_memory(config->allocator, batch_memory_start, batch_memory_size);
+    release_memory(config->allocator, files, MANIFEST_BATCH_SIZE * sizeof(file_data));
+
+    return failed_count;
 }
 
 int main(int argc, char** argv) {
-#define MAX_DIR_NAME (MAXNAMLEN + 1)
     char template_dir_name_buffer[MAX_DIR_NAME];
-    DIR* template_dir = NULL;
-
-    template_dir = get_template_dir(template_dir_name_buffer);
-
-    if(!template_dir) {
-        exit_on_error("Couldn't open the template directory\n"
-                      " '%s'", template_dir_name_buffer);
-    }
+    template_lookup lookup;
+    run_config config;
 
     //Begin processing the program arguments
     int files_to_output_count = 0;
     size_t file_names_length = 0;
-    char* destination_dir = ".";
+    int relative_files_count = 0;
+    char* template_dir_override = NULL;
+    bool rebuild_index = FALSE;
+
+    memset(&config, 0, sizeof(run_config));
+    config.destination_dir = ".";
+    config.workers_count = 1;
+    config.diagnostics_output = stderr;
+    placeholder_set_init(&config.placeholders, STUB_STR);
 
     // NOTE: First pass through the arguments.
     //       A two pass strategy has been chosen so we can allocate the
@@ -445,17 +434,98 @@ int main(int argc, char** argv) {
 
     for(int i = 1; i < argc; i++) {
         char* current_argument = argv[i];
+        if(starts_with(current_argument, '-') && current_argument[1] == '-') {
+            // NOTE(erick): Long options apply to the whole run, so they
+            // are only handled here and skipped by the second pass.
+            char* option_argument = current_argument;
+            current_argument += 2;
+            if(strcmp(current_argument, "io-uring") == 0) {
+                config.use_io_uring = TRUE;
+            } else if(strcmp(current_argument, "manifest") == 0) {
+                i++;
+                eat_argument(argc, argv, i, &config.manifest_path);
+            } else if(strcmp(current_argument, "stdin") == 0) {
+                config.manifest_path = "-";
+            } else if(strcmp(current_argument, "serve") == 0) {
+                config.serve = TRUE;
+            } else if(strcmp(current_argument, "connect") == 0) {
+                config.connect = TRUE;
+            } else if(strcmp(current_argument, "dedupe") == 0 ||
+                      strcmp(current_argument, "dedupe=reflink") == 0) {
+                config.dedupe = DEDUPE_REFLINK;
+            } else if(strcmp(current_argument, "dedupe=hardlink") == 0) {
+                config.dedupe = DEDUPE_HARDLINK;
+            } else if(strcmp(current_argument, "durability=none") == 0) {
+                config.durability = DURABILITY_NONE;
+            } else if(strcmp(current_argument, "durability=batch") == 0) {
+                config.durability = DURABILITY_BATCH;
+            } else if(strcmp(current_argument, "durability=file") == 0) {
+                config.durability = DURABILITY_FILE;
+            } else if(strcmp(current_argument, "update") == 0) {
+                config.update_files = TRUE;
+            } else if(strcmp(current_argument, "pack") == 0) {
+                i++;
+                eat_argument(argc, argv, i, &config.pack_path);
+            } else if(strcmp(current_argument, "stats") == 0 ||
+                      strcmp(current_argument, "stats=json") == 0) {
+#if TEMPLATE_STATS
+                config.show_stats = TRUE;
+                config.stats_json = current_argument[5] == '=';
+#else
+                exit_on_error("'%s' needs a build with -DTEMPLATE_STATS=1\n",
+                              option_argument);
+#endif
+            } else {
+                exit_on_error("Unknown option '%s'.\n", option_argument);
+            }
+            continue;
+        }
+
         if(starts_with(current_argument, '-')) { // It's an option
             current_argument++;
             switch(*current_argument) {
             case 'd' :
                 i++;
-                eat_argument(argc, argv, i, &destination_dir);
+                eat_argument(argc, argv, i, &config.destination_dir);
+                break;
+            case 't' :
+                i++;
+                eat_argument(argc, argv, i, &template_dir_override);
                 break;
             case 'o' :
+                // NOTE(erick): Manifest records have no options of their
+                // own, a -o anywhere applies to all of them.
+                config.override_manifest_files = TRUE;
                 break;
             case 'r' :
                 break;
+            case 'D' :
+                i++;
+                char* definition;
+                eat_argument(argc, argv, i, &definition);
+                if(!define_placeholder(&config.placeholders, definition)) {
+                    exit_on_error("Invalid definition '%s'.\n"
+                                  " Use -D KEY=VALUE, KEY is made of letters, digits and '_'\n",
+                                  definition);
+                }
+                break;
+            case 'i' :
+                rebuild_index = TRUE;
+                break;
+            case 'j' :
+                // NOTE(erick): The number of workers is optional, a file
+                // name can't be all digits since it needs an extension.
+                config.workers_count = online_cpus_count();
+                if(i + 1 < argc && is_number(argv[i + 1])) {
+                    i++;
+                    char* workers_argument;
+                    eat_argument(argc, argv, i, &workers_argument);
+                    config.workers_count = atoi(workers_argument);
+                    if(config.workers_count < 1) {
+                        config.workers_count = 1;
+                    }
+                }
+                break;
             case 'e' : // Fallthrough and ignore both the -e and the extension
             case 'R' :
                 i++; // We have the replace string to process
@@ -470,26 +540,34 @@ int main(int argc, char** argv) {
         //Default behavior (Treat as a file)
         files_to_output_count++;
         file_names_length += strlen(current_argument) + 1;
+        relative_files_count += !is_absolute_path(current_argument);
     }
 
     // Can we access the destination directory?
-    if(access(destination_dir, F_OK)) {
+    if(access(config.destination_dir, F_OK)) {
         exit_on_error("The destination directory does not exist\n"
-                      " '%s'\n", destination_dir);
+                      " '%s'\n", config.destination_dir);
     }
 
+    // NOTE(erick): Everything that lives for the whole run comes from a
+    // single arena: the file records, their paths and the template lookup.
+    // A server rebuilds its lookup over and over, so it uses the heap.
+    arena run_arena;
+    template_arena_init(&run_arena, ARENA_DEFAULT_BLOCK_SIZE);
+    template_allocator run_allocator = template_arena_allocator(&run_arena);
+    config.allocator = config.serve ? default_allocator() : &run_allocator;
+
     // Allocating the right amount of memory
-    int destination_dir_len = strlen(destination_dir) + 1;
-    file_data* files_to_output = (file_data*) malloc(files_to_output_count
-                                                     * sizeof(file_data));
-
-    // NOTE(erick): If the destination file is absolute we won't
-    // concatenate the destination_dir path which means that we
-    // probably we need less memory that we are actually allocating.
-    // But whatever!
+    int destination_dir_len = strlen(config.destination_dir) + 1;
+    file_data* files_to_output = (file_data*) allocate_zeroed(config.allocator,
+                                                              files_to_output_count + 1,
+                                                              sizeof(file_data));
+
+    // NOTE(erick): Only relative paths get the destination_dir and a '/'
+    // in front of them.
     size_t size_to_allocate =
-        files_to_output_count * destination_dir_len + file_names_length;
-    char* filenames_memory = (char*) malloc(size_to_allocate);
+        relative_files_count * destination_dir_len + file_names_length + 1;
+    char* filenames_memory = (char*) allocate_memory(config.allocator, size_to_allocate);
 
     if(!files_to_output || !filenames_memory) {
         exit_on_error("Failed to allocate memory\n");
@@ -500,32 +578,126 @@ int main(int argc, char** argv) {
     // NOTE: Second pass through the arguments happens here
     fill_files_to_output_paths(argc, argv,
                                files_to_output,
-                               destination_dir,
+                               config.destination_dir,
                                filenames_memory);
 
+    // NOTE(erick): Like -o, --update applies to every file.
+    for(int i = 0; config.update_files && i < files_to_output_count; i++) {
+        files_to_output[i].can_override = TRUE;
+        files_to_output[i].update = TRUE;
+    }
+
+    int failed_count = 0;
+
+    STATS_TIMER(template_dir_timer);
+    if(!get_template_dir(template_dir_name_buffer, template_dir_override)) {
+        exit_on_error("Could not find the template directory.\n"
+                      " Use -t [DIR] or set $" TEMPLATE_DIR_VAR "\n");
+    }
+    STATS_STAGE(STAGE_TEMPLATE_DIR, template_dir_timer);
+
+    // NOTE(erick): A client only sends its files, the server checks that
+    // it has the same template directory. Without a server (or with
+    // another directory) it does the work itself, and so does a run with
+    // anything the records can't carry: definitions, syncing, a pack to
+    // write, a cache to rebuild, dedupe or stats.
+    bool is_local_run = config.manifest_path || config.placeholders.defined_count ||
+        config.durability != DURABILITY_NONE || config.pack_path || rebuild_index ||
+        config.dedupe != DEDUPE_NONE || config.show_stats;
+    if(config.connect && !is_local_run &&
+       generate_with_server(files_to_output, files_to_output_count,
+                            template_dir_name_buffer, &failed_count)) {
+        if(failed_count) {
+            exit_on_error("%d of %d files could not be generated\n",
+                          failed_count, files_to_output_count);
+        }
+        return 0;
+    }
+
+    STATS_TIMER(lookup_timer);
+    template_error error = init_template_lookup(&lookup, template_dir_name_buffer,
+                                                rebuild_index, config.allocator);
+    STATS_STAGE(STAGE_TEMPLATE_LOOKUP, lookup_timer);
+    if(error == TEMPLATE_NO_TEMPLATE_DIR) {
+        exit_on_error("Couldn't open the template directory\n"
+                      " '%s'", template_dir_name_buffer);
+    } else if(error != TEMPLATE_OK) {
+        exit_on_error("%s\n", template_error_string(error));
+    }
+
+    if(config.pack_path) {
+        if(lookup.pack.data) {
+            exit_on_error("'%s' is a template pack already\n", template_dir_name_buffer);
+        }
 
-    get_files_extensions(files_to_output, files_to_output_count);
-    get_files_names(files_to_output, files_to_output_count);
+        uint skipped_count;
+        uint failed_count;
+        error = write_template_pack(config.pack_path, template_dir_name_buffer,
+                                    &lookup.index, config.allocator, &skipped_count,
+                                    &failed_count);
+        if(error != TEMPLATE_OK) {
+            exit_on_error("Could not write the template pack '%s'\n %s\n",
+                          config.pack_path, template_error_string(error));
+        }
+
+        // NOTE(erick): Scaffolds are left out on purpose, templates that
+        // couldn't be read make the pack incomplete, which is an error.
+        if(skipped_count) {
+            fprintf(stderr, "%u of %u templates are not regular files and were"
+                            " left out of the pack\n",
+                    skipped_count, lookup.index.template_count);
+        }
+        if(failed_count) {
+            exit_on_error("Could not read %u of %u templates, they were left out of"
+                          " the pack '%s'\n", failed_count, lookup.index.template_count,
+                          config.pack_path);
+        }
+    }
 
-    get_template_files(files_to_output, files_to_output_count,
-                       template_dir, template_dir_name_buffer);
-    closedir(template_dir);
+    if(config.serve) {
+        serve_templates(&lookup, &config);
+    }
 
-    for(int file_index = 0;
-        file_index < files_to_output_count;
-        file_index++) {
+    if(files_to_output_count) {
+        failed_count += generate_files(files_to_output, files_to_output_count,
+                                       &lookup, &config);
+    }
 
-        copy_file(files_to_output + file_index);
+    if(config.manifest_path) {
+        failed_count += generate_manifest_files(config.manifest_path, &lookup,
+                                                &config, &files_to_output_count);
+    }
+
+    // NOTE(erick): Unmaps the compiled templates, the memory itself goes
+    // away with the arena.
+    free_template_lookup(&lookup);
+
+#if DEBUG
+    template_arena_print_stats(&run_arena, stderr);
+#endif
+    template_arena_free(&run_arena);
+
+#if TEMPLATE_STATS
+    if(config.show_stats) {
+        print_run_stats(stderr, config.stats_json);
+    }
+#endif
+
+    if(failed_count) {
+        exit_on_error("%d of %d files could not be generated\n",
+                      failed_count, files_to_output_count);
     }
 
     return 0;
 }
 
-inline bool is_absolute_path(char* path) {
-    if(path == NULL) {
-         return FALSE;
+inline bool is_number(char* str) {
+    if(*str == '\0') {
+        return FALSE;
     }
 
-    // NOTE(erick): We only support Unix-like paths i.e. paths starting with '/'
-    return path[0] == '/';
+    while(isdigit(*str)) {
+        str++;
+    }
+    return *str == '\0';
 }
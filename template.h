@@ -3,8 +3,29 @@
 
 
 #define STUB_STR "???"
+#define TEMPLATE_DIR_VAR "TEMPLATE_DIR"
+#define XDG_TEMPLATES_VAR "XDG_TEMPLATES_DIR"
 
+#include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
+#include "libtemplate.h"
+#include "allocator.h"
+#include "arena.h"
+#include "copy_engine.h"
+#include "stub_replacer.h"
+#include "compiled_template.h"
+#include "placeholders.h"
+#include "dedupe.h"
+#include "durability.h"
+#include "template_index.h"
+#include "template_pack.h"
+#include "extension_table.h"
+#include "suffix_trie.h"
+#include "worker_pool.h"
+#include "uring_backend.h"
+#include "template_server.h"
+
 typedef uint8_t uint8;
 
 typedef int bool;
@@ -12,23 +33,79 @@ typedef int bool;
 #define TRUE 1
 
 #define BUFFER_SIZE 1024
+#define MAX_DIR_NAME PATH_MAX
+#define MANIFEST_BATCH_SIZE 4096
+#define MANIFEST_BATCH_MEMORY MEGA(1)
+#define TEMPLATE_PREFETCH_SIZE MEGA(16)
+#define TEMPLATE_PREFETCH_MAX_FDS 256
 
-typedef enum {
-    DONT_REPLACE,
-    REPLACE_WITH_NAME,
-    REPLACE_WITH_ARGUMENT
-} replace_mode;
-
-typedef struct {
+typedef struct file_data {
     bool can_override;
+    bool update;
     replace_mode replace;
     char* replace_string;
     char* file_path;
     char* file_extension;
     char* filename;
     char* template_file_path;
+    int template_entry;
+    // NOTE(erick): The template opened when it was prefetched, -1 if it
+    // wasn't. Whoever reads the template first takes it.
+    int template_fd;
+    // NOTE(erick): The output kept open for --durability=file to fsync,
+    // -1 if it wasn't (see keep_output_file).
+    int output_fd;
+    bool is_scaffold;
+    compression_format compression;
+    compiled_template* compiled_template;
+    template_error error;
+    bool failed;
+    placeholder_set* placeholders;
+    struct file_data* same_output_as;
+    dedupe_mode dedupe;
+    durability_mode durability;
 }file_data;
 
+// NOTE(erick): Everything needed to find (and load) the template of a
+// file. It is built once and used by all the batches of a run.
+// A compressed template is two entries: its own, which is copied as it
+// is, and one past the templates of the index (entries_count counts
+// both) that is decompressed. decompressed_sources maps those back to
+// the index.
+typedef struct template_lookup {
+    char* template_dir_name;
+    template_index index;
+    uint entries_count;
+    uint* decompressed_sources;
+    suffix_trie trie;
+    char** template_full_paths;
+    compiled_template** compiled_templates;
+    bool* compile_attempted;
+    bool rebuild_index;
+    template_pack pack;
+    template_allocator* allocator;
+} template_lookup;
+
+typedef struct run_config {
+    template_allocator* allocator;
+    char* destination_dir;
+    char* manifest_path;
+    FILE* diagnostics_output;
+    bool override_manifest_files;
+    bool update_files;
+    bool use_io_uring;
+    bool keep_templates_in_memory;
+    bool serve;
+    bool connect;
+    bool show_stats;
+    bool stats_json;
+    char* pack_path;
+    int workers_count;
+    dedupe_mode dedupe;
+    durability_mode durability;
+    placeholder_set placeholders;
+} run_config;
+
 typedef struct dirent dir_ent;
 typedef struct stat stat_buf;
 
@@ -37,17 +114,28 @@ void eat_argument(int, char**, int, char**);
 void exit_on_error(char*, ...);
 void trim_right(char*);
 char* copy_string(char*, char*);
-char* make_replace_str(char*);
+uint64 hash_string(char*);
 
-int matches_file_format(char*, char*);
 void fill_files_to_output_paths(int, char**, file_data*, char*,	char*);
 void get_files_extensions(file_data*, int);
 void get_files_names(file_data*, int);
-DIR* get_template_dir(char*);
-void get_template_files(file_data*, int, DIR*, char*);
-bool file_exists(char*);
-void copy_without_replacement(char*, char*);
-void copy_file(file_data*);
+bool get_template_dir(char*, char*);
+template_error init_template_lookup(template_lookup*, char*, bool, template_allocator*);
+void free_template_lookup(template_lookup*);
+void get_template_files(file_data*, int, template_lookup*);
+void close_prefetched_templates(file_data*, int);
+void compile_templates(file_data*, int, template_lookup*, bool);
+void set_file_error(file_data*, template_error);
+void print_file_diagnostic(file_data*, FILE*);
+int report_file_diagnostics(file_data*, int, FILE*);
+copy_strategy copy_without_replacement(file_data*);
+placeholder_values* get_placeholder_values(file_data*, placeholder_values*);
+bool output_is_unchanged(file_data*, placeholder_values*);
+bool copy_file(file_data*);
+int generate_files(file_data*, int, template_lookup*, run_config*);
+int generate_manifest_files(char*, template_lookup*, run_config*, int*);
+int generate_manifest_stream(FILE*, template_lookup*, run_config*, int*);
+bool is_number(char*);
 bool is_absolute_path(char*);
 
 #endif
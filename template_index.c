@@ -0,0 +1,334 @@
+/* The names of the files in the template directory are cached in
+ * $XDG_CACHE_HOME/template/ (~/.cache/template/ by default) so that a run
+ * only has to stat the template directory instead of reading all of it.
+ *
+ * The cache records the device, inode and modification time of the
+ * directory. Adding, removing or renaming a template changes the mtime,
+ * in which case the directory is read again and the cache is replaced
+ * (written to a temporary file and renamed over the old one, so
+ * concurrent runs never see a partial index).
+ *
+ * Cache format:
+ *   template-index 1\n
+ *   <dev> <ino> <mtime sec> <mtime nsec> <template count>\n
+ *   <template directory>\n
+ *   <name>\0<name>\0...
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "template.h"
+#include "template_index.h"
+#include "stats.h"
+
+static bool get_cache_file_path(char* template_dir_name, char* cache_file_path) {
+    char cache_dir[PATH_MAX];
+    char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+    char* home = getenv("HOME");
+
+    int written;
+    if(xdg_cache_home && is_absolute_path(xdg_cache_home)) {
+        written = snprintf(cache_dir, PATH_MAX, "%s", xdg_cache_home);
+    } else if(home && *home) {
+        written = snprintf(cache_dir, PATH_MAX, "%s/.cache", home);
+    } else {
+        return FALSE;
+    }
+    if(written >= PATH_MAX) {
+        return FALSE;
+    }
+
+    // NOTE(erick): Failing here is fine, opening the cache will fail later.
+    mkdir(cache_dir, 0700);
+    written = snprintf(cache_file_path, PATH_MAX, "%s/" TEMPLATE_INDEX_CACHE_DIR,
+                       cache_dir);
+    if(written >= PATH_MAX) {
+        return FALSE;
+    }
+    mkdir(cache_file_path, 0700);
+
+    written = snprintf(cache_file_path, PATH_MAX, "%s/" TEMPLATE_INDEX_CACHE_DIR
+                       "/index-%016llx", cache_dir,
+                       (unsigned long long) hash_string(template_dir_name));
+    return written < PATH_MAX;
+}
+
+static bool fill_template_names(template_index* index, char* names,
+                                char* names_end) {
+    index->template_names = (char**) allocate_memory(index->allocator,
+                                                     (index->template_count + 1) *
+                                                     sizeof(char*));
+    if(!index->template_names) {
+        return FALSE;
+    }
+
+    uint name_index = 0;
+    while(names < names_end && name_index < index->template_count) {
+        index->template_names[name_index++] = names;
+        names += strlen(names) + 1;
+    }
+
+    return name_index == index->template_count;
+}
+
+static bool read_cached_index(char* cache_file_path, char* template_dir_name,
+                              stat_buf* dir_stat, template_index* index) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int cache_fd = open(cache_file_path, O_RDONLY);
+    if(cache_fd < 0) {
+        return FALSE;
+    }
+
+    STATS_SYSCALL(SYSCALL_STAT);
+    STATS_SYSCALL(SYSCALL_CLOSE);
+
+    stat_buf cache_stat;
+    if(fstat(cache_fd, &cache_stat) || cache_stat.st_size == 0) {
+        close(cache_fd);
+        return FALSE;
+    }
+
+    size_t cache_size = cache_stat.st_size;
+    // NOTE(erick): The extra byte makes sure the buffer is NUL terminated
+    // even if the cache file was truncated.
+    char* cache_data = (char*) allocate_memory(index->allocator, cache_size + 1);
+    if(!cache_data) {
+        close(cache_fd);
+        return FALSE;
+    }
+
+    STATS_SYSCALL(SYSCALL_READ);
+    STATS_BYTES_READ(cache_size);
+    ssize_t n_read = read(cache_fd, cache_data, cache_size);
+    close(cache_fd);
+    if(n_read != (ssize_t) cache_size) {
+        release_memory(index->allocator, cache_data, cache_size + 1);
+        return FALSE;
+    }
+    cache_data[cache_size] = '\0';
+
+    unsigned long long dev, ino;
+    long long mtime_sec;
+    long mtime_nsec;
+    uint template_count;
+    int header_len = 0;
+
+    if(sscanf(cache_data, TEMPLATE_INDEX_MAGIC "\n%llu %llu %lld %ld %u\n%n",
+              &dev, &ino, &mtime_sec, &mtime_nsec, &template_count,
+              &header_len) != 5 || header_len == 0) {
+        release_memory(index->allocator, cache_data, cache_size + 1);
+        return FALSE;
+    }
+
+    char* cached_dir_name = cache_data + header_len;
+    char* names = strchr(cached_dir_name, '\n');
+
+    if(!names ||
+       dev != (unsigned long long) dir_stat->st_dev ||
+       ino != (unsigned long long) dir_stat->st_ino ||
+       mtime_sec != (long long) dir_stat->st_mtim.tv_sec ||
+       mtime_nsec != dir_stat->st_mtim.tv_nsec ||
+       (size_t) (names - cached_dir_name) != strlen(template_dir_name) ||
+       strncmp(cached_dir_name, template_dir_name, names - cached_dir_name) != 0) {
+        release_memory(index->allocator, cache_data, cache_size + 1);
+        return FALSE;
+    }
+    names++;
+
+    index->names_memory = cache_data;
+    index->names_memory_size = cache_size + 1;
+    index->template_count = template_count;
+    if(!fill_template_names(index, names, cache_data + cache_size)) {
+        free_template_index(index);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// NOTE(erick): Devices, FIFOs and sockets can't be templates (opening a
+// FIFO would even block), d_type tells them apart without a stat. File
+// systems that don't fill d_type give DT_UNKNOWN, those entries are kept.
+static bool can_be_template(linux_dirent64* entry) {
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        return FALSE;
+    }
+
+    return entry->d_type == DT_REG || entry->d_type == DT_DIR ||
+        entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN;
+}
+
+static bool push_template_name(template_index* index, char** names, size_t* names_size,
+                               size_t* names_capacity, char* name) {
+    size_t name_len = strlen(name) + 1;
+    if(*names_size + name_len > *names_capacity) {
+        size_t new_capacity = *names_capacity;
+        while(*names_size + name_len > new_capacity) {
+            new_capacity *= 2;
+        }
+        char* new_names = (char*) reallocate_memory(index->allocator, *names,
+                                                    *names_capacity, new_capacity);
+        if(!new_names) {
+            return FALSE;
+        }
+        *names = new_names;
+        *names_capacity = new_capacity;
+    }
+
+    memcpy(*names + *names_size, name, name_len);
+    *names_size += name_len;
+    index->template_count++;
+    return TRUE;
+}
+
+// NOTE(erick): The directory is read with getdents64 straight into a big
+// buffer, so even huge directories take a handful of calls.
+static bool read_template_dir(char* template_dir_name, template_index* index) {
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int template_dir_fd = open(template_dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(template_dir_fd < 0) {
+        return FALSE;
+    }
+
+    // NOTE(erick): The entries buffer is scratch memory, it comes from the
+    // heap so it doesn't stay in an arena for the whole run.
+    template_allocator* scratch_allocator = default_allocator();
+    char* entries = (char*) allocate_memory(scratch_allocator, TEMPLATE_DIR_BUFFER_SIZE);
+
+    size_t names_capacity = KILO(4);
+    size_t names_size = 0;
+    char* names = (char*) allocate_memory(index->allocator, names_capacity);
+
+    index->template_count = 0;
+    bool read_ok = entries && names;
+
+    while(read_ok) {
+        STATS_SYSCALL(SYSCALL_READDIR);
+        long n_read = syscall(SYS_getdents64, template_dir_fd, entries,
+                              TEMPLATE_DIR_BUFFER_SIZE);
+        if(n_read <= 0) {
+            read_ok = (n_read == 0);
+            break;
+        }
+
+        for(long offset = 0; read_ok && offset < n_read;) {
+            linux_dirent64* entry = (linux_dirent64*) (entries + offset);
+            offset += entry->d_reclen;
+
+            if(can_be_template(entry)) {
+                read_ok = push_template_name(index, &names, &names_size, &names_capacity,
+                                             entry->d_name);
+            }
+        }
+    }
+
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(template_dir_fd);
+    release_memory(scratch_allocator, entries, TEMPLATE_DIR_BUFFER_SIZE);
+
+    if(!read_ok) {
+        release_memory(index->allocator, names, names_capacity);
+        return FALSE;
+    }
+
+    index->names_memory = names;
+    index->names_memory_size = names_capacity;
+    if(!fill_template_names(index, names, names + names_size)) {
+        free_template_index(index);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void write_cached_index(char* cache_file_path, char* template_dir_name,
+                               stat_buf* dir_stat, template_index* index) {
+    // NOTE(erick): If the directory changed in the same second we read
+    // it, a change made right after our readdir could keep the same mtime
+    // on filesystems with coarse timestamps. We don't cache in that case.
+    if(dir_stat->st_mtim.tv_sec >= time(NULL)) {
+        return;
+    }
+
+    char temp_file_path[PATH_MAX + 32];
+    snprintf(temp_file_path, sizeof(temp_file_path), "%s.%d.tmp",
+             cache_file_path, (int) getpid());
+
+    FILE* temp_file = fopen(temp_file_path, "wb");
+    if(!temp_file) {
+        return;
+    }
+
+    fprintf(temp_file, TEMPLATE_INDEX_MAGIC "\n%llu %llu %lld %ld %u\n%s\n",
+            (unsigned long long) dir_stat->st_dev,
+            (unsigned long long) dir_stat->st_ino,
+            (long long) dir_stat->st_mtim.tv_sec,
+            (long) dir_stat->st_mtim.tv_nsec,
+            index->template_count, template_dir_name);
+
+    for(uint i = 0; i < index->template_count; i++) {
+        fwrite(index->template_names[i], 1, strlen(index->template_names[i]) + 1,
+               temp_file);
+    }
+
+    bool failed = ferror(temp_file);
+    if(fclose(temp_file) || failed || rename(temp_file_path, cache_file_path)) {
+        unlink(temp_file_path);
+    }
+}
+
+bool load_template_index(char* template_dir_name, bool force_rebuild,
+                         template_index* index, template_allocator* allocator) {
+    memset(index, 0, sizeof(template_index));
+    index->allocator = allocator;
+
+    stat_buf dir_stat;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(stat(template_dir_name, &dir_stat) || !S_ISDIR(dir_stat.st_mode)) {
+        return FALSE;
+    }
+
+    char cache_file_path[PATH_MAX];
+    bool has_cache = get_cache_file_path(template_dir_name, cache_file_path);
+
+    if(has_cache && !force_rebuild &&
+       read_cached_index(cache_file_path, template_dir_name, &dir_stat, index)) {
+        return TRUE;
+    }
+
+    if(!read_template_dir(template_dir_name, index)) {
+        return FALSE;
+    }
+
+    if(has_cache) {
+        write_cached_index(cache_file_path, template_dir_name, &dir_stat, index);
+    }
+
+    return TRUE;
+}
+
+void free_template_index(template_index* index) {
+    // NOTE(erick): template_count can be anything when filling the names
+    // failed, but then template_names was never allocated.
+    if(index->template_names) {
+        release_memory(index->allocator, index->template_names,
+                       (index->template_count + 1) * sizeof(char*));
+    }
+    release_memory(index->allocator, index->names_memory, index->names_memory_size);
+    index->template_names = NULL;
+    index->names_memory = NULL;
+    index->names_memory_size = 0;
+    index->template_count = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef TEMPLATE_INDEX_H
+#define TEMPLATE_INDEX_H 1
+
+#include "default_definitions.h"
+#include "allocator.h"
+
+#define TEMPLATE_INDEX_MAGIC "template-index 2"
+#define TEMPLATE_INDEX_CACHE_DIR "template"
+#define TEMPLATE_DIR_BUFFER_SIZE KILO(64)
+
+// NOTE(erick): A record of getdents64, glibc only has a wrapper for it
+// since 2.30.
+typedef struct {
+    uint64 d_ino;
+    int64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64;
+
+typedef struct {
+    char** template_names;
+    uint template_count;
+    char* names_memory;
+    size_t names_memory_size;
+    template_allocator* allocator;
+} template_index;
+
+bool load_template_index(char*, bool, template_index*, template_allocator*);
+void free_template_index(template_index*);
+
+#endif
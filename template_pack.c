@@ -0,0 +1,423 @@
+/* Template packs: a whole template directory in a single file.
+ *
+ * template --pack FILE writes the templates of the template directory,
+ * with their modes and the offsets of their stubs, to FILE. Using FILE as
+ * the template directory (-t FILE or $TEMPLATE_DIR) then maps it once and
+ * takes the index, the compiled templates and the bodies of the outputs
+ * from the mapping. On a network file system that is one open and one
+ * sequential read instead of a readdir and an open and stat per template.
+ *
+ * Layout (native byte order, everything 8 byte aligned but the names):
+ *   template_pack_header
+ *   the bodies
+ *   template_pack_entry[template_count]
+ *   uint64 stub offsets, the ones of each entry together
+ *   the names, NUL terminated
+ *
+ * The header has the offsets of the rest, so packs with the bodies last
+ * (as the first ones were written) are read just the same.
+ *
+ * Only regular files are packed, scaffolds (directories) are left out.
+ * The pack is not refreshed by itself: run --pack again after changing
+ * the templates.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "template.h"
+#include "template_pack.h"
+#include "copy_engine.h"
+#include "stub_replacer.h"
+#include "output_file.h"
+#include "stats.h"
+
+#define PACK_ALIGN(size) (((size) + 7) & ~((uint64) 7))
+
+static bool pack_range_is_valid(template_pack* pack, uint64 offset, uint64 size) {
+    return offset <= pack->data_size && size <= pack->data_size - offset;
+}
+
+bool load_template_pack(char* pack_path, template_pack* pack) {
+    memset(pack, 0, sizeof(template_pack));
+
+    // NOTE(erick): The stub offsets are used in place as size_t (and
+    // written from the compiled templates as they are).
+    if(sizeof(size_t) != sizeof(uint64)) {
+        return FALSE;
+    }
+
+    STATS_SYSCALL(SYSCALL_OPEN);
+    int pack_fd = open(pack_path, O_RDONLY | O_CLOEXEC);
+    if(pack_fd < 0) {
+        return FALSE;
+    }
+
+    struct stat pack_stat;
+    STATS_SYSCALL(SYSCALL_STAT);
+    if(fstat(pack_fd, &pack_stat) || !S_ISREG(pack_stat.st_mode) ||
+       (size_t) pack_stat.st_size < sizeof(template_pack_header)) {
+        STATS_SYSCALL(SYSCALL_CLOSE);
+        close(pack_fd);
+        return FALSE;
+    }
+
+    // NOTE(erick): MAP_POPULATE reads the whole pack up front, in big
+    // sequential reads, instead of faulting it in page by page.
+    pack->data_size = pack_stat.st_size;
+    STATS_SYSCALL(SYSCALL_MMAP);
+    STATS_BYTES_READ(pack->data_size);
+    void* data = mmap(NULL, pack->data_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                      pack_fd, 0);
+    STATS_SYSCALL(SYSCALL_CLOSE);
+    close(pack_fd);
+    if(data == MAP_FAILED) {
+        return FALSE;
+    }
+    pack->data = (uint8*) data;
+
+    template_pack_header* header = (template_pack_header*) pack->data;
+    uint64 entries_size = (uint64) header->template_count * sizeof(template_pack_entry);
+    bool is_valid =
+        memcmp(header->magic, TEMPLATE_PACK_MAGIC, TEMPLATE_PACK_MAGIC_SIZE) == 0 &&
+        header->byte_order == TEMPLATE_PACK_BYTE_ORDER &&
+        header->file_size == pack->data_size &&
+        header->entries_offset % 8 == 0 && header->stubs_offset % 8 == 0 &&
+        pack_range_is_valid(pack, header->entries_offset, entries_size) &&
+        header->stubs_offset >= header->entries_offset + entries_size &&
+        header->names_offset >= header->stubs_offset &&
+        pack_range_is_valid(pack, header->names_offset, header->names_size) &&
+        (header->names_size == 0 ||
+         pack->data[header->names_offset + header->names_size - 1] == '\0');
+
+    if(!is_valid) {
+        free_template_pack(pack);
+        return FALSE;
+    }
+
+    pack->header = header;
+    pack->entries = (template_pack_entry*) (pack->data + header->entries_offset);
+    pack->stub_offsets = (uint64*) (pack->data + header->stubs_offset);
+    pack->names = (char*) (pack->data + header->names_offset);
+
+    return TRUE;
+}
+
+// NOTE(erick): The names stay in the mapping, only the array pointing to
+// them is allocated.
+bool load_pack_index(template_pack* pack, template_index* index,
+                     template_allocator* allocator) {
+    memset(index, 0, sizeof(template_index));
+    index->allocator = allocator;
+
+    uint template_count = pack->header->template_count;
+    index->template_names = (char**) allocate_memory(allocator, (template_count + 1) *
+                                                     sizeof(char*));
+    if(!index->template_names) {
+        return FALSE;
+    }
+    index->template_count = template_count;
+
+    for(uint entry_index = 0; entry_index < template_count; entry_index++) {
+        template_pack_entry* entry = pack->entries + entry_index;
+        if((uint64) entry->name_offset + entry->name_len >= pack->header->names_size ||
+           pack->names[entry->name_offset + entry->name_len] != '\0') {
+            free_template_index(index);
+            return FALSE;
+        }
+        index->template_names[entry_index] = pack->names + entry->name_offset;
+    }
+
+    return TRUE;
+}
+
+// NOTE(erick): The entry is only checked when it is used, so a run pays
+// for the templates it needs and not for the whole pack.
+bool get_packed_template(template_pack* pack, uint entry_index, char* stub,
+                         compiled_template* template) {
+    memset(template, 0, sizeof(compiled_template));
+    if(entry_index >= pack->header->template_count) {
+        return FALSE;
+    }
+
+    template_pack_entry* entry = pack->entries + entry_index;
+    uint64 stubs_count = (pack->header->names_offset - pack->header->stubs_offset) /
+        sizeof(uint64);
+    size_t stub_len = strlen(stub);
+
+    if(pack->header->stub_len != stub_len ||
+       !pack_range_is_valid(pack, entry->data_offset, entry->data_size) ||
+       entry->first_stub > stubs_count ||
+       entry->stub_count > stubs_count - entry->first_stub) {
+        return FALSE;
+    }
+
+    uint64* stub_offsets = pack->stub_offsets + entry->first_stub;
+    uint64 span_start = 0;
+    for(uint stub_index = 0; stub_index < entry->stub_count; stub_index++) {
+        if(stub_offsets[stub_index] < span_start ||
+           stub_offsets[stub_index] + stub_len > entry->data_size) {
+            return FALSE;
+        }
+        span_start = stub_offsets[stub_index] + stub_len;
+    }
+
+    template->data = pack->data + entry->data_offset;
+    template->data_size = entry->data_size;
+    template->mode = entry->mode;
+    template->stub_len = stub_len;
+    template->stub_offsets = (size_t*) stub_offsets;
+    template->stub_count = entry->stub_count;
+    template->is_packed = TRUE;
+
+    return TRUE;
+}
+
+void free_template_pack(template_pack* pack) {
+    if(pack->data) {
+        munmap(pack->data, pack->data_size);
+    }
+    memset(pack, 0, sizeof(template_pack));
+}
+
+typedef struct {
+    struct iovec iovecs[REPLACE_MAX_IOVECS];
+    int iovecs_count;
+    int output_fd;
+} pack_writer;
+
+static bool write_pack_data(pack_writer* writer, void* data, size_t data_size) {
+    if(data_size == 0) {
+        return TRUE;
+    }
+
+    if(writer->iovecs_count == REPLACE_MAX_IOVECS) {
+        if(!write_iovecs(writer->output_fd, writer->iovecs, writer->iovecs_count)) {
+            return FALSE;
+        }
+        writer->iovecs_count = 0;
+    }
+
+    writer->iovecs[writer->iovecs_count].iov_base = data;
+    writer->iovecs[writer->iovecs_count].iov_len = data_size;
+    writer->iovecs_count++;
+    return TRUE;
+}
+
+static bool write_pack_padding(pack_writer* writer, uint64 size) {
+    static uint8 padding[8];
+    return write_pack_data(writer, padding, PACK_ALIGN(size) - size);
+}
+
+static bool flush_pack_writer(pack_writer* writer) {
+    bool written = write_iovecs(writer->output_fd, writer->iovecs, writer->iovecs_count);
+    writer->iovecs_count = 0;
+    return written;
+}
+
+// NOTE(erick): Only regular files are packed. skipped_count tells how many
+// templates of the index were left out for not being one and
+// failed_count how many couldn't be read (or decompressed). Compressed
+// templates are packed twice, as they are under their own name and
+// decompressed under the name inside the suffix, after all the others
+// (see init_template_lookup). Every body is written as soon as its
+// template is compiled and is unmapped right away, so a big directory
+// doesn't need a mapping per template. The pack is replaced at once, like
+// any output written with -o.
+template_error write_template_pack(char* pack_path, char* template_dir_name,
+                                   template_index* index, template_allocator* allocator,
+                                   uint* skipped_count, uint* failed_count) {
+    *skipped_count = 0;
+    *failed_count = 0;
+    if(sizeof(size_t) != sizeof(uint64)) {
+        return TEMPLATE_INVALID_ARGUMENT;
+    }
+
+    uint template_count = index->template_count;
+    uint compressed_count = 0;
+    for(uint entry_index = 0; entry_index < template_count; entry_index++) {
+        compressed_count += template_compression(index->template_names[entry_index],
+                                                 NULL) != COMPRESSION_NONE;
+    }
+
+    // NOTE(erick): The stub offsets grow as the templates are compiled,
+    // they are scratch memory and come from the heap.
+    template_allocator* scratch_allocator = default_allocator();
+    uint entries_count = template_count + compressed_count;
+    template_pack_entry* entries = (template_pack_entry*) allocate_zeroed(
+        allocator, entries_count + 1, sizeof(template_pack_entry));
+    char** names = (char**) allocate_zeroed(allocator, entries_count + 1, sizeof(char*));
+    bool* is_packed = (bool*) allocate_zeroed(allocator, template_count + 1, sizeof(bool));
+    uint64* stub_offsets = NULL;
+    uint64 stubs_capacity = 0;
+
+    template_error result = TEMPLATE_OK;
+    output_file output;
+    if(!entries || !names || !is_packed) {
+        result = TEMPLATE_NO_MEMORY;
+    } else {
+        result = open_output_file(pack_path, S_IFREG | 0644, TRUE, &output);
+    }
+    if(result != TEMPLATE_OK) {
+        release_memory(allocator, is_packed, (template_count + 1) * sizeof(bool));
+        release_memory(allocator, names, (entries_count + 1) * sizeof(char*));
+        release_memory(allocator, entries, (entries_count + 1) * sizeof(template_pack_entry));
+        return result;
+    }
+
+    pack_writer writer;
+    writer.iovecs_count = 0;
+    writer.output_fd = output.fd;
+
+    // NOTE(erick): The bodies come right after the header, which is only
+    // known at the end. A blank one holds its place until then.
+    template_pack_header header;
+    memset(&header, 0, sizeof(template_pack_header));
+    bool written = write_pack_data(&writer, &header, sizeof(template_pack_header)) &&
+        write_pack_padding(&writer, sizeof(template_pack_header));
+
+    uint64 data_offset = PACK_ALIGN(sizeof(template_pack_header));
+    uint64 stubs_count = 0;
+    uint64 names_size = 0;
+    uint count = 0;
+    for(uint slot = 0; written && slot < 2 * template_count; slot++) {
+        uint entry_index = slot % template_count;
+        char* name = index->template_names[entry_index];
+        size_t name_len = strlen(name);
+        compression_format compression = COMPRESSION_NONE;
+        if(slot >= template_count) {
+            size_t suffix_len;
+            compression = template_compression(name, &suffix_len);
+            if(compression == COMPRESSION_NONE || !is_packed[entry_index]) {
+                continue;
+            }
+            name_len -= suffix_len;
+        }
+
+        char template_path[PATH_MAX];
+        int path_len = snprintf(template_path, PATH_MAX, "%s/%s", template_dir_name, name);
+        if(path_len < 0 || path_len >= PATH_MAX) {
+            (*failed_count)++;
+            continue;
+        }
+
+        // NOTE(erick): Directories (scaffolds) and special files are left
+        // out on purpose, anything else that can't be compiled failed.
+        if(slot < template_count) {
+            struct stat template_stat;
+            STATS_SYSCALL(SYSCALL_STAT);
+            if(stat(template_path, &template_stat)) {
+                (*failed_count)++;
+                continue;
+            }
+            if(!S_ISREG(template_stat.st_mode)) {
+                (*skipped_count)++;
+                continue;
+            }
+        }
+
+        compiled_template template;
+        if(!compile_template(template_path, -1, STUB_STR, compression, &template,
+                             allocator)) {
+            (*failed_count)++;
+            continue;
+        }
+
+        if(stubs_count + template.stub_count > stubs_capacity) {
+            uint64 new_capacity = stubs_capacity ? stubs_capacity : 256;
+            while(new_capacity < stubs_count + template.stub_count) {
+                new_capacity *= 2;
+            }
+            uint64* new_offsets = (uint64*) reallocate_memory(
+                scratch_allocator, stub_offsets, stubs_capacity * sizeof(uint64),
+                new_capacity * sizeof(uint64));
+            if(!new_offsets) {
+                free_compiled_template(&template);
+                result = TEMPLATE_NO_MEMORY;
+                break;
+            }
+            stub_offsets = new_offsets;
+            stubs_capacity = new_capacity;
+        }
+        if(template.stub_count) {
+            memcpy(stub_offsets + stubs_count, template.stub_offsets,
+                   template.stub_count * sizeof(uint64));
+        }
+
+        names[count] = name;
+        template_pack_entry* entry = entries + count;
+        entry->data_offset = data_offset;
+        entry->data_size = template.data_size;
+        entry->first_stub = stubs_count;
+        entry->stub_count = template.stub_count;
+        entry->mode = template.mode;
+        entry->name_offset = names_size;
+        entry->name_len = name_len;
+
+        written = write_pack_data(&writer, template.data, template.data_size) &&
+            write_pack_padding(&writer, template.data_size) &&
+            flush_pack_writer(&writer);
+        free_compiled_template(&template);
+
+        data_offset = PACK_ALIGN(data_offset + entry->data_size);
+        stubs_count += entry->stub_count;
+        names_size += entry->name_len + 1;
+        is_packed[entry_index] = TRUE;
+        count++;
+    }
+
+    if(result == TEMPLATE_OK && names_size > UINT32_MAX) {
+        result = TEMPLATE_NO_MEMORY;
+    }
+
+    // NOTE(erick): The entries, the stub offsets and the names go after
+    // the bodies.
+    memcpy(header.magic, TEMPLATE_PACK_MAGIC, TEMPLATE_PACK_MAGIC_SIZE);
+    header.byte_order = TEMPLATE_PACK_BYTE_ORDER;
+    header.stub_len = strlen(STUB_STR);
+    header.template_count = count;
+    header.names_size = names_size;
+    header.entries_offset = data_offset;
+    header.stubs_offset = header.entries_offset + count * sizeof(template_pack_entry);
+    header.names_offset = header.stubs_offset + stubs_count * sizeof(uint64);
+    header.file_size = header.names_offset + names_size;
+
+    written = written && result == TEMPLATE_OK &&
+        write_pack_data(&writer, entries, count * sizeof(template_pack_entry)) &&
+        write_pack_data(&writer, stub_offsets, stubs_count * sizeof(uint64));
+
+    // NOTE(erick): The name of a decompressed template is the start of
+    // the name of its file, so the '\0' is written on its own.
+    for(uint entry_index = 0; written && entry_index < count; entry_index++) {
+        written = write_pack_data(&writer, names[entry_index],
+                                  entries[entry_index].name_len) &&
+            write_pack_data(&writer, "", 1);
+    }
+
+    if(written) {
+        STATS_SYSCALL(SYSCALL_WRITE);
+        written = flush_pack_writer(&writer) &&
+            pwrite(output.fd, &header, sizeof(template_pack_header), 0) ==
+            sizeof(template_pack_header);
+    }
+
+    template_error close_result = close_output_file(&output, pack_path, written);
+    if(result == TEMPLATE_OK) {
+        result = close_result;
+    }
+
+    release_memory(scratch_allocator, stub_offsets, stubs_capacity * sizeof(uint64));
+    release_memory(allocator, is_packed, (template_count + 1) * sizeof(bool));
+    release_memory(allocator, names, (entries_count + 1) * sizeof(char*));
+    release_memory(allocator, entries, (entries_count + 1) * sizeof(template_pack_entry));
+
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef TEMPLATE_PACK_H
+#define TEMPLATE_PACK_H 1
+
+#include <stddef.h>
+#include "default_definitions.h"
+#include "allocator.h"
+#include "libtemplate.h"
+#include "template_index.h"
+#include "compiled_template.h"
+
+#define TEMPLATE_PACK_MAGIC "template-pack 1\n"
+#define TEMPLATE_PACK_MAGIC_SIZE 16
+#define TEMPLATE_PACK_BYTE_ORDER 0x01020304
+
+// NOTE(erick): Everything in a pack is 8 byte aligned, so the stub offsets
+// can be used right from the mapping.
+typedef struct {
+    char magic[TEMPLATE_PACK_MAGIC_SIZE];
+    uint32 byte_order;
+    uint32 template_count;
+    uint32 stub_len;
+    uint32 names_size;
+    uint64 entries_offset;
+    uint64 stubs_offset;
+    uint64 names_offset;
+    uint64 file_size;
+} template_pack_header;
+
+typedef struct {
+    uint64 data_offset;
+    uint64 data_size;
+    uint64 first_stub;
+    uint32 stub_count;
+    uint32 mode;
+    uint32 name_offset;
+    uint32 name_len;
+} template_pack_entry;
+
+typedef struct {
+    uint8* data;
+    size_t data_size;
+    template_pack_header* header;
+    template_pack_entry* entries;
+    uint64* stub_offsets;
+    char* names;
+} template_pack;
+
+bool load_template_pack(char*, template_pack*);
+bool load_pack_index(template_pack*, template_index*, template_allocator*);
+bool get_packed_template(template_pack*, uint, char*, compiled_template*);
+void free_template_pack(template_pack*);
+template_error write_template_pack(char*, char*, template_index*, template_allocator*, uint*,
+                                   uint*);
+
+#endif
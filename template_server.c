@@ -0,0 +1,404 @@
+/* Resident template server.
+ *
+ * "template --serve" keeps the template lookup (index, suffix trie and
+ * compiled templates, plain copies included) in memory and answers
+ * requests on a Unix socket. inotify watches on the template directory
+ * and every directory inside it (the scaffolds) mark the lookup stale
+ * whenever a template is added, removed or changed, and it is rebuilt
+ * before the next request.
+ *
+ * "template --connect ..." sends its files to the server instead of
+ * generating them itself, and falls back to doing the work locally if
+ * there is no server or the files can't be written as manifest records.
+ *
+ * Protocol: the client writes a "TEMPLATE_DIR <path>" line with the real
+ * path of its template directory, then manifest records (see
+ * generate_manifest_stream) with absolute paths, and shuts down its
+ * writing side. A server with another template directory answers
+ * "WRONG_TEMPLATE_DIR" and the client does the work itself. Otherwise
+ * the server answers with the diagnostics of the files followed by a
+ * "STATUS <failed> <total>" line. Clients are answered one
+ * at a time, a client that stops sending for SERVER_CLIENT_TIMEOUT
+ * seconds is dropped so it can't hold up the others.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#if LINUX
+#include <sys/inotify.h>
+
+#define WATCHED_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                        IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |             \
+                        IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+#include "template.h"
+#include "template_server.h"
+#include "string_buffer.h"
+
+void get_socket_path(char* socket_path, size_t socket_path_size) {
+    char* configured_path = getenv(TEMPLATE_SOCKET_VAR);
+    char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if(configured_path && *configured_path) {
+        snprintf(socket_path, socket_path_size, "%s", configured_path);
+    } else if(runtime_dir && is_absolute_path(runtime_dir)) {
+        snprintf(socket_path, socket_path_size, "%s/template.sock", runtime_dir);
+    } else {
+        snprintf(socket_path, socket_path_size, "/tmp/template-%d.sock", (int) getuid());
+    }
+}
+
+static bool fill_socket_address(struct sockaddr_un* address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    char socket_path[PATH_MAX];
+    get_socket_path(socket_path, PATH_MAX);
+    if(strlen(socket_path) >= sizeof(address->sun_path)) {
+        return FALSE;
+    }
+
+    strcpy(address->sun_path, socket_path);
+    return TRUE;
+}
+
+// NOTE(erick): Scaffolds are directories of the template directory, a
+// change deep inside one must make the lookup stale too. Watching a
+// directory again is harmless, so new directories are picked up by
+// watching the whole tree after every rebuild. Symbolic links are not
+// followed, scaffolds copy them as they are.
+static void watch_template_tree(int inotify_fd, char* path, int depth) {
+#if LINUX
+    inotify_add_watch(inotify_fd, path, WATCHED_EVENTS);
+    if(depth >= SERVER_MAX_WATCH_DEPTH) {
+        return;
+    }
+
+    DIR* directory = opendir(path);
+    if(!directory) {
+        return; // A pack is a single file
+    }
+
+    struct dirent* dir_entry;
+    while((dir_entry = readdir(directory))) {
+        if(strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char child_path[PATH_MAX];
+        if(snprintf(child_path, PATH_MAX, "%s/%s", path,
+                    dir_entry->d_name) >= PATH_MAX) {
+            continue;
+        }
+
+        bool is_directory = (dir_entry->d_type == DT_DIR);
+        if(dir_entry->d_type == DT_UNKNOWN) {
+            struct stat stat_buffer;
+            is_directory = lstat(child_path, &stat_buffer) == 0 &&
+                S_ISDIR(stat_buffer.st_mode);
+        }
+        if(is_directory) {
+            watch_template_tree(inotify_fd, child_path, depth + 1);
+        }
+    }
+
+    closedir(directory);
+#endif
+}
+
+static bool drain_inotify_events(int inotify_fd) {
+    char events[KILO(4)];
+    bool changed = FALSE;
+
+    while(read(inotify_fd, events, sizeof(events)) > 0) {
+        changed = TRUE;
+    }
+
+    return changed;
+}
+
+static void answer_request(int client_fd, template_lookup* lookup, run_config* config) {
+    // NOTE(erick): A client that stops sending (or reading) times out, the
+    // records it sent completely are still generated.
+    struct timeval timeout = {SERVER_CLIENT_TIMEOUT, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    FILE* request = fdopen(client_fd, "r");
+    FILE* response = fdopen(dup(client_fd), "w");
+    if(!request || !response) {
+        if(request) {
+            fclose(request);
+        } else {
+            close(client_fd);
+        }
+        return;
+    }
+
+    // NOTE(erick): The files of a client are only generated from the
+    // templates it would have used itself.
+    StringBuffer string_buffer;
+    string_buffer_init(&string_buffer);
+    char template_dir_path[PATH_MAX];
+    size_t prefix_len = strlen(SERVER_TEMPLATE_DIR_PREFIX);
+    bool same_template_dir =
+        string_buffer_read_line(request, &string_buffer) &&
+        strncmp(string_buffer.buffer_data, SERVER_TEMPLATE_DIR_PREFIX, prefix_len) == 0 &&
+        realpath(lookup->template_dir_name, template_dir_path) &&
+        strcmp(string_buffer.buffer_data + prefix_len, template_dir_path) == 0;
+    free_string_buffer(&string_buffer);
+
+    if(!same_template_dir) {
+        fprintf(response, SERVER_WRONG_TEMPLATE_DIR "\n");
+        fclose(response);
+        fclose(request);
+        return;
+    }
+
+    config->diagnostics_output = response;
+
+    int total_count = 0;
+    int failed_count = generate_manifest_stream(request, lookup, config, &total_count);
+    fprintf(response, SERVER_STATUS_PREFIX "%d %d\n", failed_count, total_count);
+
+    config->diagnostics_output = stderr;
+    fclose(response);
+    fclose(request);
+}
+
+void serve_templates(template_lookup* lookup, run_config* config) {
+    struct sockaddr_un address;
+    if(!fill_socket_address(&address)) {
+        exit_on_error("The socket path is too long\n");
+    }
+
+    // NOTE(erick): A client going away must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    config->keep_templates_in_memory = TRUE;
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0) {
+        exit_on_error("Could not create the socket\n");
+    }
+
+    // NOTE(erick): The socket is created with only the owner bits right
+    // away, there is no moment in which others could connect to it.
+    unlink(address.sun_path);
+    mode_t old_umask = umask(077);
+    int bind_result = bind(listen_fd, (struct sockaddr*) &address, sizeof(address));
+    umask(old_umask);
+    if(bind_result || listen(listen_fd, 64)) {
+        exit_on_error("Could not listen on \"%s\"\n", address.sun_path);
+    }
+
+#if LINUX
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    int inotify_fd = -1;
+#endif
+    if(inotify_fd >= 0) {
+        watch_template_tree(inotify_fd, lookup->template_dir_name, 0);
+    } else {
+        fprintf(stderr, "Could not watch the template directory,"
+                        " templates are read only once\n");
+    }
+
+    bool lookup_is_stale = FALSE;
+    struct pollfd poll_fds[2];
+    poll_fds[0].fd = listen_fd;
+    poll_fds[0].events = POLLIN;
+    poll_fds[1].fd = inotify_fd;
+    poll_fds[1].events = POLLIN;
+
+    while(TRUE) {
+        if(poll(poll_fds, (inotify_fd >= 0) ? 2 : 1, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            exit_on_error("poll failed\n");
+        }
+
+        if(inotify_fd >= 0 && (poll_fds[1].revents & POLLIN)) {
+            lookup_is_stale |= drain_inotify_events(inotify_fd);
+        }
+
+        if(!(poll_fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(client_fd < 0) {
+            continue;
+        }
+
+        // NOTE(erick): Events that arrived while we waited for the client.
+        if(inotify_fd >= 0) {
+            lookup_is_stale |= drain_inotify_events(inotify_fd);
+        }
+
+        if(lookup_is_stale) {
+            // NOTE(erick): If the directory can't be read right now the old
+            // lookup is used and we try again on the next request.
+            char* template_dir_name = lookup->template_dir_name;
+            template_lookup new_lookup;
+            if(init_template_lookup(&new_lookup, template_dir_name, TRUE,
+                                    lookup->allocator) == TEMPLATE_OK) {
+                free_template_lookup(lookup);
+                *lookup = new_lookup;
+                lookup_is_stale = FALSE;
+            }
+
+            // NOTE(erick): The directory itself may have been replaced, and
+            // new scaffold directories need their own watches.
+            if(inotify_fd >= 0) {
+                watch_template_tree(inotify_fd, template_dir_name, 0);
+            }
+        }
+
+        answer_request(client_fd, lookup, config);
+    }
+}
+
+static bool has_record_separator(char* field) {
+    return field && strpbrk(field, "\t\n\r");
+}
+
+// NOTE(erick): Manifest records can't tell an empty or "-" replace string
+// from copying as is and deriving it from the name, and have no escapes
+// for tabs and newlines. Such files are generated locally instead.
+static bool can_send_to_server(file_data* file) {
+    if(file->replace == REPLACE_WITH_ARGUMENT &&
+       (!file->replace_string || *file->replace_string == '\0' ||
+        strcmp(file->replace_string, "-") == 0 ||
+        has_record_separator(file->replace_string))) {
+        return FALSE;
+    }
+
+    return !has_record_separator(file->file_path) &&
+        !has_record_separator(file->file_extension);
+}
+
+static char* manifest_replace_field(file_data* file) {
+    switch(file->replace) {
+    case REPLACE_WITH_NAME :
+        return "-";
+    case REPLACE_WITH_ARGUMENT :
+        return file->replace_string;
+    default :
+        return "";
+    }
+}
+
+bool generate_with_server(file_data* files, int files_count, char* template_dir_name,
+                          int* failed_count) {
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        if(!can_send_to_server(files + file_index)) {
+            return FALSE;
+        }
+    }
+
+    // NOTE(erick): A template directory we can't resolve is reported by
+    // the local run.
+    char template_dir_path[PATH_MAX];
+    if(!realpath(template_dir_name, template_dir_path) ||
+       has_record_separator(template_dir_path)) {
+        return FALSE;
+    }
+
+    struct sockaddr_un address;
+    if(!fill_socket_address(&address)) {
+        return FALSE;
+    }
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(server_fd < 0) {
+        return FALSE;
+    }
+
+    if(connect(server_fd, (struct sockaddr*) &address, sizeof(address))) {
+        close(server_fd);
+        return FALSE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    char current_dir[PATH_MAX];
+    if(!getcwd(current_dir, PATH_MAX)) {
+        close(server_fd);
+        return FALSE;
+    }
+
+    // NOTE(erick): The server has its own working directory, so the paths
+    // are sent absolute.
+    FILE* request = fdopen(dup(server_fd), "w");
+    if(!request) {
+        close(server_fd);
+        return FALSE;
+    }
+
+    fprintf(request, SERVER_TEMPLATE_DIR_PREFIX "%s\n", template_dir_path);
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* file = files + file_index;
+        if(!is_absolute_path(file->file_path)) {
+            fprintf(request, "%s/", current_dir);
+        }
+        fprintf(request, "%s\t%s\t%s\t%s%s\n", file->file_path,
+                manifest_replace_field(file),
+                file->file_extension ? file->file_extension : "",
+                file->can_override ? "o" : "",
+                file->update ? "u" : "");
+    }
+
+    bool sent = (fclose(request) == 0);
+    shutdown(server_fd, SHUT_WR);
+
+    FILE* response = fdopen(server_fd, "r");
+    if(!response) {
+        close(server_fd);
+        return FALSE;
+    }
+
+    StringBuffer string_buffer;
+    string_buffer_init(&string_buffer);
+
+    bool got_status = FALSE;
+    bool wrong_template_dir = FALSE;
+    while(string_buffer_read_line(response, &string_buffer)) {
+        char* line = string_buffer.buffer_data;
+        if(strcmp(line, SERVER_WRONG_TEMPLATE_DIR) == 0) {
+            wrong_template_dir = TRUE;
+        } else if(strncmp(line, SERVER_STATUS_PREFIX, strlen(SERVER_STATUS_PREFIX)) == 0) {
+            got_status = (sscanf(line + strlen(SERVER_STATUS_PREFIX), "%d",
+                                 failed_count) == 1);
+        } else {
+            fwrite(line, 1, string_buffer.length, stderr);
+            fputc('\n', stderr);
+        }
+    }
+
+    free_string_buffer(&string_buffer);
+    fclose(response);
+
+    if(wrong_template_dir) {
+        return FALSE;
+    }
+    if(sent && !got_status) {
+        exit_on_error("The template server closed the connection\n");
+    }
+
+    return sent && got_status;
+}
@@ -0,0 +1,21 @@
+#ifndef TEMPLATE_SERVER_H
+#define TEMPLATE_SERVER_H 1
+
+#include "default_definitions.h"
+
+#define TEMPLATE_SOCKET_VAR "TEMPLATE_SOCKET"
+#define SERVER_STATUS_PREFIX "STATUS "
+#define SERVER_TEMPLATE_DIR_PREFIX "TEMPLATE_DIR "
+#define SERVER_WRONG_TEMPLATE_DIR "WRONG_TEMPLATE_DIR"
+#define SERVER_CLIENT_TIMEOUT 10
+#define SERVER_MAX_WATCH_DEPTH 32
+
+struct file_data;
+struct template_lookup;
+struct run_config;
+
+void get_socket_path(char*, size_t);
+void serve_templates(struct template_lookup*, struct run_config*);
+bool generate_with_server(struct file_data*, int, char*, int*);
+
+#endif
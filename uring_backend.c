@@ -0,0 +1,419 @@
+/* io_uring backend for big batches.
+ *
+ * Outputs are generated in batches of URING_BATCH_SIZE files with three
+ * io_uring_enter calls per batch: one for all the openat, one for all the
+ * writev and one for all the close. The template bodies come from the
+ * compiled templates (already mapped in memory) so there is nothing to
+ * read per output.
+ *
+ * io_uring has no fchmod, so outputs are created with the template mode.
+ * fchmod is only called when the umask took some bits away. Outputs that
+ * may overwrite a file (-o) are opened as O_TMPFILE in their directory and
+ * linked in place before the close, as in output_file.c.
+ *
+ * Files the ring can't handle (templates that could not be mapped or with
+ * more than URING_MAX_IOVECS spans) go through copy_file as usual.
+ * If the kernel has no io_uring (or it is blocked, as in some containers)
+ * generate_files_with_uring returns FALSE and nothing was done.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "template.h"
+#include "uring_backend.h"
+#include "output_file.h"
+#include "stats.h"
+
+#if LINUX
+#include <linux/io_uring.h>
+
+typedef struct {
+    int ring_fd;
+    uint* sq_tail;
+    uint* sq_mask;
+    uint* sq_array;
+    struct io_uring_sqe* sqes;
+    uint* cq_head;
+    uint* cq_tail;
+    uint* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+typedef struct {
+    file_data* file;
+    output_file output;
+    size_t expected_size;
+    int iovecs_count;
+    struct iovec iovecs[URING_MAX_IOVECS];
+    placeholder_values values;
+    char directory[PATH_MAX];
+} uring_job;
+
+static void uring_exit(uring* ring) {
+    if(ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if(ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->ring_fd);
+}
+
+static bool uring_supports_ops(int ring_fd) {
+    size_t probe_size = sizeof(struct io_uring_probe) +
+        256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*) calloc(1, probe_size);
+    if(!probe) {
+        return FALSE;
+    }
+
+    bool result = FALSE;
+    if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        uint8 needed_ops[] = { IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_CLOSE };
+        result = TRUE;
+        for(uint i = 0; i < sizeof(needed_ops); i++) {
+            if(needed_ops[i] > probe->last_op ||
+               !(probe->ops[needed_ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                result = FALSE;
+            }
+        }
+    }
+
+    free(probe);
+    return result;
+}
+
+static bool uring_init(uring* ring, uint entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring));
+
+    ring->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->ring_fd < 0) {
+        return FALSE;
+    }
+
+    if(!uring_supports_ops(ring->ring_fd)) {
+        close(ring->ring_fd);
+        return FALSE;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint);
+    ring->cq_ring_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // NOTE(erick): Since 5.4 both rings share a single mapping.
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_exit(ring);
+        return FALSE;
+    }
+
+    if(single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_exit(ring);
+            return FALSE;
+        }
+    }
+
+    void* sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        uring_exit(ring);
+        return FALSE;
+    }
+    ring->sqes = (struct io_uring_sqe*) sqes;
+
+    uint8* sq_ring = (uint8*) ring->sq_ring;
+    uint8* cq_ring = (uint8*) ring->cq_ring;
+    ring->sq_tail = (uint*) (sq_ring + params.sq_off.tail);
+    ring->sq_mask = (uint*) (sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (uint*) (sq_ring + params.sq_off.array);
+    ring->cq_head = (uint*) (cq_ring + params.cq_off.head);
+    ring->cq_tail = (uint*) (cq_ring + params.cq_off.tail);
+    ring->cq_mask = (uint*) (cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq_ring + params.cq_off.cqes);
+
+    return TRUE;
+}
+
+static struct io_uring_sqe* uring_get_sqe(uring* ring, uint64 user_data) {
+    // NOTE(erick): We are the only producer and we never queue more than
+    // the ring size before waiting, so there is always a free entry.
+    uint tail = *ring->sq_tail;
+    uint index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = ring->sqes + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+// NOTE(erick): Submits the count queued entries, waits for all of them and
+// stores each result at results[user_data].
+static void uring_run(uring* ring, uint count, int* results) {
+    uint unsubmitted = count;
+    uint completed = 0;
+
+    while(completed < count) {
+        STATS_SYSCALL(SYSCALL_IO_URING_ENTER);
+        int submitted = syscall(__NR_io_uring_enter, ring->ring_fd, unsubmitted, 1,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+        if(submitted < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            exit_on_error("io_uring_enter failed\n");
+        }
+        unsubmitted -= submitted;
+
+        uint head = *ring->cq_head;
+        uint tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail) {
+            struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_mask);
+            results[cqe->user_data] = cqe->res;
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static void skip_written_bytes(uring_job* job, size_t n_written) {
+    struct iovec* iovecs = job->iovecs;
+    while(job->iovecs_count > 0 && n_written >= iovecs->iov_len) {
+        n_written -= iovecs->iov_len;
+        iovecs++;
+        job->iovecs_count--;
+    }
+    if(job->iovecs_count > 0) {
+        iovecs->iov_base = (char*) iovecs->iov_base + n_written;
+        iovecs->iov_len -= n_written;
+    }
+    memmove(job->iovecs, iovecs, job->iovecs_count * sizeof(struct iovec));
+}
+
+static void generate_batch(uring* ring, file_data* files, int files_count,
+                           uring_job* jobs, int* results, mode_t process_umask) {
+    uint jobs_count = 0;
+    // NOTE(erick): Files of a batch are done together, so their latency
+    // is the one of the whole batch.
+    STATS_TIMER(batch_timer);
+
+    for(int file_index = 0; file_index < files_count; file_index++) {
+        file_data* file = files + file_index;
+        uring_job* job = jobs + jobs_count;
+
+        if(file->failed || file->same_output_as) {
+            continue;
+        }
+
+        if(!file->compiled_template) {
+            copy_file(file);
+            continue;
+        }
+
+        // NOTE(erick): The values have to live until the writev of the
+        // batch, so they are kept in the job.
+        placeholder_values* values = get_placeholder_values(file, &job->values);
+
+        if(output_is_unchanged(file, values)) {
+            continue;
+        }
+
+        job->iovecs_count = compiled_template_iovecs(file->compiled_template, values,
+                                                     job->iovecs, URING_MAX_IOVECS);
+        if(job->iovecs_count < 0) {
+            copy_file(file);
+            continue;
+        }
+
+        job->file = file;
+        job->expected_size = 0;
+        for(int i = 0; i < job->iovecs_count; i++) {
+            job->expected_size += job->iovecs[i].iov_len;
+        }
+
+        // NOTE(erick): The same opens as open_output_file, the directory
+        // has to live until the openat is submitted.
+        char* open_path = file->file_path;
+        int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+        if(file->can_override) {
+            if(!output_directory(file->file_path, job->directory, sizeof(job->directory))) {
+                copy_file(file);
+                continue;
+            }
+            open_path = job->directory;
+            flags = O_TMPFILE | O_WRONLY | O_CLOEXEC;
+        }
+
+        job->output.mode = file->compiled_template->mode & 07777;
+        job->output.is_temporary = file->can_override;
+        job->output.needs_chmod = (job->output.mode & process_umask) != 0;
+        job->output.start_writeback = (file->durability == DURABILITY_FILE);
+        job->output.keep_fd = job->output.start_writeback ? &file->output_fd : NULL;
+
+        struct io_uring_sqe* sqe = uring_get_sqe(ring, jobs_count);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64) (uintptr_t) open_path;
+        sqe->len = job->output.mode;
+        sqe->open_flags = flags;
+        jobs_count++;
+    }
+
+    uring_run(ring, jobs_count, results);
+
+    uint writes_count = 0;
+    for(uint job_index = 0; job_index < jobs_count; job_index++) {
+        uring_job* job = jobs + job_index;
+        int fd = results[job_index];
+        job->output.fd = fd;
+
+        if(job->output.is_temporary && (fd == -EOPNOTSUPP || fd == -EISDIR)) {
+            // NOTE(erick): No O_TMPFILE on this file system, copy_file
+            // knows what to do instead.
+            job->output.fd = -1;
+            copy_file(job->file);
+        } else if(fd == -EEXIST && !job->output.is_temporary) {
+            set_file_error(job->file, TEMPLATE_FILE_EXISTS);
+        } else if(fd < 0) {
+            set_file_error(job->file, TEMPLATE_OPEN_OUTPUT_FAILED);
+        } else if(job->iovecs_count > 0) {
+            struct io_uring_sqe* sqe = uring_get_sqe(ring, job_index);
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = fd;
+            sqe->addr = (uint64) (uintptr_t) job->iovecs;
+            sqe->len = job->iovecs_count;
+            sqe->off = 0;
+            writes_count++;
+        } else {
+            results[job_index] = 0;
+        }
+    }
+
+    uring_run(ring, writes_count, results);
+
+    uint closes_count = 0;
+    for(uint job_index = 0; job_index < jobs_count; job_index++) {
+        uring_job* job = jobs + job_index;
+        if(job->output.fd < 0) {
+            continue;
+        }
+
+        // NOTE(erick): A short write is finished synchronously.
+        bool written = results[job_index] >= 0;
+        if(written) {
+            STATS_BYTES_WRITTEN(results[job_index]);
+        }
+        if(written && (size_t) results[job_index] < job->expected_size) {
+            skip_written_bytes(job, results[job_index]);
+            written = write_iovecs(job->output.fd, job->iovecs, job->iovecs_count);
+        }
+
+        template_error error = TEMPLATE_WRITE_FAILED;
+        if(written) {
+            error = commit_output_file(&job->output, job->file->file_path);
+        }
+        if(job->output.keep_fd && !template_error_is_failure(error)) {
+            template_error keep_error = keep_output_file(&job->output);
+            if(keep_error != TEMPLATE_OK) {
+                error = keep_error;
+            }
+        }
+        if(error != TEMPLATE_OK) {
+            set_file_error(job->file, error);
+        }
+        if(job->output.fd < 0) {
+            continue;
+        }
+
+        struct io_uring_sqe* sqe = uring_get_sqe(ring, job_index);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = job->output.fd;
+        closes_count++;
+    }
+
+    uring_run(ring, closes_count, results);
+
+    for(uint job_index = 0; job_index < jobs_count; job_index++) {
+        uring_job* job = jobs + job_index;
+        if(job->output.fd >= 0 && results[job_index] < 0 && !job->file->failed) {
+            set_file_error(job->file, TEMPLATE_WRITE_FAILED);
+        }
+        STATS_FILE(batch_timer);
+    }
+}
+
+bool generate_files_with_uring(file_data* files, int files_count) {
+    uring ring;
+    if(!uring_init(&ring, URING_BATCH_SIZE)) {
+        return FALSE;
+    }
+
+    uring_job* jobs = (uring_job*) malloc(URING_BATCH_SIZE * sizeof(uring_job));
+    int* results = (int*) malloc(URING_BATCH_SIZE * sizeof(int));
+    if(!jobs || !results) {
+        exit_on_error("Could not allocate memory\n");
+    }
+
+    mode_t process_umask = output_umask();
+
+    for(int batch_start = 0; batch_start < files_count; batch_start += URING_BATCH_SIZE) {
+        int batch_count = files_count - batch_start;
+        if(batch_count > URING_BATCH_SIZE) {
+            batch_count = URING_BATCH_SIZE;
+        }
+
+        generate_batch(&ring, files + batch_start, batch_count,
+                       jobs, results, process_umask);
+    }
+
+    free(jobs);
+    free(results);
+    uring_exit(&ring);
+    return TRUE;
+}
+
+#else
+
+bool generate_files_with_uring(file_data* files, int files_count) {
+    return FALSE;
+}
+
+#endif
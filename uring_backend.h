@@ -0,0 +1,13 @@
+#ifndef URING_BACKEND_H
+#define URING_BACKEND_H 1
+
+#include "default_definitions.h"
+
+#define URING_BATCH_SIZE 256
+#define URING_MAX_IOVECS 64
+
+struct file_data;
+
+bool generate_files_with_uring(struct file_data*, int);
+
+#endif
@@ -0,0 +1,86 @@
+/* Runs work_function(context, index) for every index in [0, items_count)
+ * using up to workers_count threads (the calling thread included).
+ *
+ * There is no queue: every worker claims the next index with an atomic
+ * increment, which keeps all the threads busy until the very end even if
+ * some items are much slower than others (e.g. a big template on NFS).
+ *
+ * A run_in_parallel called from an item of a pool with several workers
+ * (e.g. a scaffold generated among other files) runs its items inline:
+ * the outer pool already has a thread per CPU, nested pools would only
+ * multiply them.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "worker_pool.h"
+
+typedef struct {
+    work_function function;
+    void* context;
+    int items_count;
+    int next_item;
+    bool is_shared;
+} work_batch;
+
+static __thread bool inside_shared_pool = FALSE;
+
+static void* worker_main(void* batch_pointer) {
+    work_batch* batch = (work_batch*) batch_pointer;
+    bool was_inside_shared_pool = inside_shared_pool;
+    inside_shared_pool = was_inside_shared_pool || batch->is_shared;
+
+    while(TRUE) {
+        int item = __atomic_fetch_add(&batch->next_item, 1, __ATOMIC_RELAXED);
+        if(item >= batch->items_count) {
+            break;
+        }
+        batch->function(batch->context, item);
+    }
+
+    inside_shared_pool = was_inside_shared_pool;
+    return NULL;
+}
+
+int online_cpus_count() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+void run_in_parallel(work_function function, void* context,
+                     int items_count, int workers_count) {
+    work_batch batch;
+    batch.function = function;
+    batch.context = context;
+    batch.items_count = items_count;
+    batch.next_item = 0;
+
+    if(inside_shared_pool) {
+        workers_count = 1;
+    }
+    if(workers_count > items_count) {
+        workers_count = items_count;
+    }
+    if(workers_count > MAX_WORKERS) {
+        workers_count = MAX_WORKERS;
+    }
+    batch.is_shared = (workers_count > 1);
+
+    pthread_t threads[MAX_WORKERS];
+    int threads_count = 0;
+
+    // NOTE(erick): If a thread can't be created the remaining workers
+    // (at least the calling thread) just take more items.
+    for(int i = 1; i < workers_count; i++) {
+        if(pthread_create(threads + threads_count, NULL, worker_main, &batch) == 0) {
+            threads_count++;
+        }
+    }
+
+    worker_main(&batch);
+
+    for(int i = 0; i < threads_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H 1
+
+#include "default_definitions.h"
+
+#define MAX_WORKERS 256
+
+typedef void (*work_function)(void*, int);
+
+int online_cpus_count();
+void run_in_parallel(work_function, void*, int, int);
+
+#endif